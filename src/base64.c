@@ -5,13 +5,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 #include "base64.h"
 
 static const uint8_t base64dec_tab[256]= {
   255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
   255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
   255,255,255,255,255,255,255,255,255,255,255, 62,255,255,255, 63,
-   52, 53, 54, 55, 56, 57, 58, 59, 60, 61,255,255,255,  0,255,255,
+   52, 53, 54, 55, 56, 57, 58, 59, 60, 61,255,255,255,255,255,255,
   255,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,255,255,255,255,255,
   255, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
@@ -26,49 +27,6 @@ static const uint8_t base64dec_tab[256]= {
   255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
 };
 
-#if 0
-static int ICACHE_FLASH_ATTR base64decode(const char in[4], char out[3]) {
-  uint8_t v[4];
-  v[0]=base64dec_tab[(unsigned)in[0]];
-  v[1]=base64dec_tab[(unsigned)in[1]];
-  v[2]=base64dec_tab[(unsigned)in[2]];
-  v[3]=base64dec_tab[(unsigned)in[3]];
-  out[0]=(v[0]<<2)|(v[1]>>4); 
-  out[1]=(v[1]<<4)|(v[2]>>2); 
-  out[2]=(v[2]<<6)|(v[3]); 
-  return (v[0]|v[1]|v[2]|v[3])!=255 ? in[3]=='=' ? in[2]=='=' ? 1 : 2 : 3 : 0;
-}
-#endif
-
-/* decode a base64 string in one shot */
-/*int ICACHE_FLASH_ATTR base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *out) {
-  unsigned int ii, io;
-  uint32_t v;
-  unsigned int rem;
-
-  for(io=0,ii=0,v=0,rem=0;ii<in_len;ii++) {
-    unsigned char ch;
-    if(isspace((int)in[ii])) continue;
-    if(in[ii]=='=') break; // stop at = 
-    ch=base64dec_tab[(unsigned int)in[ii]];
-    if(ch==255) break; // stop at a parse error 
-    v=(v<<6)|ch;
-    rem+=6;
-    if(rem>=8) {
-      rem-=8;
-      if(io>=out_len) return -1; // truncation is failure
-      out[io++]=(v>>rem)&255;
-    }
-  }
-  if(rem>=8) {
-    rem-=8;
-    if(io>=out_len) return -1; // truncation is failure
-    out[io++]=(v>>rem)&255;
-  }
-  return io;
-}
-*/
-
 static const uint8_t base64enc_tab[64]= "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 void base64encode(const unsigned char in[3], unsigned char out[4], int count) {
@@ -79,32 +37,176 @@ void base64encode(const unsigned char in[3], unsigned char out[4], int count) {
 }
 
 
+/* encode one 3 byte group, table lookups only */
+#define BASE64_ENCODE3(in, out) do { \
+  (out)[0]=base64enc_tab[(in)[0]>>2]; \
+  (out)[1]=base64enc_tab[(((in)[0]&3)<<4)|((in)[1]>>4)]; \
+  (out)[2]=base64enc_tab[(((in)[1]&15)<<2)|((in)[2]>>6)]; \
+  (out)[3]=base64enc_tab[(in)[2]&63]; \
+} while (0)
+
+/* encode the last 1 or 2 bytes with padding */
+static void base64_encodeTail(const unsigned char *in, size_t count, char out[4]) {
+  unsigned char last[3];
+  last[0]=in[0];
+  last[1]=count>1 ? in[1] : 0;
+  last[2]=0;
+  BASE64_ENCODE3(last, out);
+  out[3]='=';
+  if(count<2) out[2]='=';
+}
+
+/* encode in one shot, NUL terminated.  returns the length without the NUL, or
+ * -1 if out is too small */
 int base64_encode(size_t in_len, const unsigned char *in, size_t out_len, char *out) {
-  unsigned ii, io;
-  uint_least32_t v;
-  unsigned rem;
-
-  for(io=0,ii=0,v=0,rem=0;ii<in_len;ii++) {
-    unsigned char ch;
-    ch=in[ii];
-    v=(v<<8)|ch;
-    rem+=8;
-    while(rem>=6) {
-      rem-=6;
-      if(io>=out_len) return -1; /* truncation is failure */
-      out[io++]=base64enc_tab[(v>>rem)&63];
+  size_t io=BASE64_ENCODED_LENGTH(in_len);
+
+  if(io>=out_len) return -1; /* truncation is failure */
+
+  for(;in_len>=3;in_len-=3,in+=3,out+=4) BASE64_ENCODE3(in, out);
+  if(in_len) {
+    base64_encodeTail(in, in_len, out);
+    out+=4;
+  }
+  *out=0;
+  return io;
+}
+
+/* streaming encoder: up to 2 bytes are carried between calls.  Each update
+ * writes 4 characters per complete group, at most
+ * BASE64_ENCODED_LENGTH(in_len + 2), final writes up to 4.  No NUL is added */
+void base64_encode_init(base64_state *st) {
+  st->count=0;
+  st->done=0;
+}
+
+size_t base64_encode_update(base64_state *st, const unsigned char *in, size_t in_len, char *out) {
+  char *o=out;
+
+  while(st->count && in_len) {
+    st->buf[st->count++]=*in++;
+    in_len--;
+    if(st->count==3) {
+      BASE64_ENCODE3(st->buf, o);
+      o+=4;
+      st->count=0;
     }
   }
-  if(rem) {
-    v<<=(6-rem);
-    if(io>=out_len) return -1; /* truncation is failure */
-    out[io++]=base64enc_tab[v&63];
+  for(;in_len>=3;in_len-=3,in+=3,o+=4) BASE64_ENCODE3(in, o);
+  while(in_len--) st->buf[st->count++]=*in++;
+
+  return o-out;
+}
+
+size_t base64_encode_final(base64_state *st, char *out) {
+  if(!st->count) return 0;
+  base64_encodeTail(st->buf, st->count, out);
+  st->count=0;
+  return 4;
+}
+
+/* streaming decoder: up to 3 characters are carried between calls.  White
+ * space is skipped and '=' ends the input.  Each update writes at most
+ * 3 * ((carried + in_len) / 4) bytes and returns how many, or -1 on a
+ * character that isn't base64 */
+void base64_decode_init(base64_state *st) {
+  st->count=0;
+  st->done=0;
+}
+
+int base64_decode_update(base64_state *st, const char *in, size_t in_len, unsigned char *out) {
+  unsigned char *o=out;
+
+  while(in_len && !st->done) {
+    if(st->count==0) {
+      /* fast path, whole groups of 4 valid characters */
+      while(in_len>=4) {
+        uint8_t v0=base64dec_tab[(uint8_t)in[0]];
+        uint8_t v1=base64dec_tab[(uint8_t)in[1]];
+        uint8_t v2=base64dec_tab[(uint8_t)in[2]];
+        uint8_t v3=base64dec_tab[(uint8_t)in[3]];
+        /* 255 marks padding, white space and anything invalid */
+        if((v0|v1|v2|v3)==255) break;
+        o[0]=(v0<<2)|(v1>>4);
+        o[1]=(v1<<4)|(v2>>2);
+        o[2]=(v2<<6)|v3;
+        o+=3;
+        in+=4;
+        in_len-=4;
+      }
+      if(!in_len) break;
+    }
+
+    /* a character at a time around white space, padding and call boundaries */
+    unsigned char ch=*in++;
+    in_len--;
+    if(isspace(ch)) continue;
+    if(ch=='=') {
+      st->done=1;
+      break;
+    }
+    if(base64dec_tab[ch]==255) return -1;
+    st->buf[st->count++]=base64dec_tab[ch];
+    if(st->count==4) {
+      o[0]=(st->buf[0]<<2)|(st->buf[1]>>4);
+      o[1]=(st->buf[1]<<4)|(st->buf[2]>>2);
+      o[2]=(st->buf[2]<<6)|st->buf[3];
+      o+=3;
+      st->count=0;
+    }
   }
-  while(io&3) {
-    if(io>=out_len) return -1; /* truncation is failure */
-    out[io++]='=';
+
+  return o-out;
+}
+
+/* flush the 1 or 2 bytes held in a final partial group.  returns how many,
+ * or -1 if a lone character was left over */
+int base64_decode_final(base64_state *st, unsigned char *out) {
+  int n=0;
+  if(st->count==1) return -1;
+  if(st->count>=2) out[n++]=(st->buf[0]<<2)|(st->buf[1]>>4);
+  if(st->count==3) out[n++]=(st->buf[1]<<4)|(st->buf[2]>>2);
+  st->count=0;
+  return n;
+}
+
+/* decode a base64 string in one shot.  returns the number of bytes, or -1
+ * on a parse error or if out is too small */
+int base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *out) {
+  base64_state st;
+  unsigned char tmp[3];
+  size_t io=0;
+  int n;
+
+  base64_decode_init(&st);
+  while(in_len && !st.done) {
+    /* feed no more than can be decoded into the space left */
+    size_t room=out_len-io;
+    size_t chunk=room>=3 ? (room/3)*4-st.count : 1;
+    unsigned char *dst=room>=3 ? out+io : tmp;
+
+    if(chunk>in_len) chunk=in_len;
+    n=base64_decode_update(&st, in, chunk, dst);
+    if(n<0) return -1;
+    if(dst==tmp) {
+      if((size_t)n>room) return -1; /* truncation is failure */
+      memcpy(out+io, tmp, n);
+    }
+    io+=n;
+    in+=chunk;
+    in_len-=chunk;
   }
-  if(io>=out_len) return -1; /* no room for null terminator */
-  out[io]=0;
-  return io;
+
+  n=base64_decode_final(&st, tmp);
+  if(n<0 || io+n>out_len) return -1;
+  memcpy(out+io, tmp, n);
+  return io+n;
+}
+
+/* encode exactly 20 bytes (a sha1 hash) into 28 characters plus terminator */
+void base64_encode20(const unsigned char in[20], char out[29]) {
+  int i;
+  for(i=0;i<18;i+=3) BASE64_ENCODE3(in+i, out+i/3*4);
+  base64_encodeTail(in+18, 2, out+24);
+  out[28]=0;
 }
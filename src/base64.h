@@ -1,7 +1,27 @@
 #ifndef _BASE_64_H_
 #define _BASE_64_H_
 
-//int base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *out);
+//characters needed to encode n bytes (without the NUL), and an upper bound
+//on the bytes n characters decode to
+#define BASE64_ENCODED_LENGTH(n) ((((n) + 2) / 3) * 4)
+#define BASE64_DECODED_LENGTH(n) (((n) / 4) * 3 + 2)
+
+//state of a streaming encode or decode
+typedef struct base64_state {
+  unsigned char buf[4];
+  unsigned char count;
+  unsigned char done;
+} base64_state;
+
+int base64_decode(size_t in_len, const char *in, size_t out_len, unsigned char *out);
 int base64_encode(size_t in_len, const unsigned char *in, size_t out_len, char *out);
 
+void base64_encode_init(base64_state *st);
+size_t base64_encode_update(base64_state *st, const unsigned char *in, size_t in_len, char *out);
+size_t base64_encode_final(base64_state *st, char *out);
+void base64_decode_init(base64_state *st);
+int base64_decode_update(base64_state *st, const char *in, size_t in_len, unsigned char *out);
+int base64_decode_final(base64_state *st, unsigned char *out);
+void base64_encode20(const unsigned char in[20], char out[29]);
+
 #endif // _BASE_64_H_
@@ -9,86 +9,441 @@ extern "C" {
 #include "sha1.h"
 #include "base64.h"
 }
+#include "wsframe.h"
+#include "wsdeflate.h"
+#include "wspool.h"
+#include "wslog.h"
 #include "easyWebSocket.h"
 
-espconn webSocketConn;
-esp_tcp webSocketTcp;
+static int ICACHE_FLASH_ATTR        createWsAcceptKey(const char *key, char *buffer, int bufferSize);
+static uint32_t ICACHE_FLASH_ATTR   feedWsHandshake(WSConnection *wsConnection, char *data, uint32_t len);
+static uint8_t ICACHE_FLASH_ATTR    matchWsHandshakeHeader(const char *name, uint8_t nameLength);
+static void ICACHE_FLASH_ATTR       takeWsHandshakeHeader(WSConnection *wsConnection);
+static bool ICACHE_FLASH_ATTR       hasWsToken(const char *list, uint8_t listLength, const char *token);
+#if WS_DEFLATE
+static uint8_t ICACHE_FLASH_ATTR    parseWsDeflateOffers(const char *list, uint8_t listLength);
+static uint8_t ICACHE_FLASH_ATTR    parseWsDeflateOffer(const char *offer, uint8_t offerLength);
+static uint8_t ICACHE_FLASH_ATTR    parseWsWindowBits(const char *value, uint8_t valueLength);
+#endif
+static void ICACHE_FLASH_ATTR       finishWsHandshake(WSConnection *wsConnection);
+static void ICACHE_FLASH_ATTR       takeWsResponseHeader(WSConnection *wsConnection);
+static void ICACHE_FLASH_ATTR       finishWsClientHandshake(WSConnection *wsConnection);
+static void ICACHE_FLASH_ATTR       openWsSlot(WSConnection *wsConnection, struct espconn *connection);
+static void ICACHE_FLASH_ATTR       registerWsServer(WSServer *server);
+static void ICACHE_FLASH_ATTR       rejectWsHandshake(WSConnection *wsConnection, const char *response);
+static void ICACHE_FLASH_ATTR       feedWsFrames(WSConnection *wsConnection, char *data, uint32_t len);
+static bool ICACHE_FLASH_ATTR       acceptWsFrame(WSConnection *wsConnection);
+static void ICACHE_FLASH_ATTR       completeWsFrame(WSConnection *wsConnection, WSFrame *frame, char *lastByte);
+static sint8 ICACHE_FLASH_ATTR      sendWsRaw(WSConnection *connection, const char *data, uint32_t length);
+static WSTxBuffer *ICACHE_FLASH_ATTR buildWsFrame(const char *payload, uint32_t payloadLength, uint8_t options, uint8_t deflateWindowBits, bool mask);
+static uint32_t ICACHE_FLASH_ATTR   encodeWsFrame(uint8_t *out, const char *payload, uint32_t payloadLength, uint8_t options, bool mask);
+static uint8_t ICACHE_FLASH_ATTR    wsFrameHeaderLength(uint32_t payloadLength, bool mask);
+#if WS_DEFLATE
+static WSTxBuffer *ICACHE_FLASH_ATTR deflateWsFrame(const char *payload, uint32_t payloadLength, uint8_t options, uint8_t windowBits);
+#endif
+static void ICACHE_FLASH_ATTR       initWsPools(void);
+static void *ICACHE_FLASH_ATTR      allocWsBlock(uint32_t size);
+static void ICACHE_FLASH_ATTR       freeWsBlock(void *block);
+static WSTxBuffer *ICACHE_FLASH_ATTR allocWsTxBuffer(uint32_t length);
+static void ICACHE_FLASH_ATTR       releaseWsTxBuffer(WSTxBuffer *buffer);
+static sint8 ICACHE_FLASH_ATTR      queueWsTxBuffer(WSConnection *connection, WSTxBuffer *buffer);
+static int16_t ICACHE_FLASH_ATTR    findWsLatest(WSConnection *connection, uint8_t key);
+static void ICACHE_FLASH_ATTR       sendWsTxQueue(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       sendWsTxChunk(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       resumeWsTx(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       stallWsTx(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       unstallWsTx(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       disconnectWsIfIdle(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       flushWsTxQueue(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       takeWsPong(WSConnection *wsConnection, WSFrame *frame);
+static bool ICACHE_FLASH_ATTR       takeWsSubscription(WSConnection *wsConnection, WSFrame *frame);
+static uint8_t ICACHE_FLASH_ATTR    hashWsTopic(const char *name, uint8_t nameLength);
+static void ICACHE_FLASH_ATTR       sendWsToSubscribers(WSServer *server,
+                                                        const uint32_t *subscribers,
+                                                        const char *payload,
+                                                        uint32_t payloadLength,
+                                                        uint8_t options);
+#if WS_METRICS
+static void ICACHE_FLASH_ATTR       countWsFrame(uint32_t *frames, uint32_t *bytes, uint8_t opcode, uint32_t payloadLength);
+static void ICACHE_FLASH_ATTR       addWsMetrics(WSMetrics *total, const WSMetrics *metrics);
+static int ICACHE_FLASH_ATTR        formatWsCounters(char *buffer, int bufferSize, const char *name, const uint32_t *counters);
+#endif
+static void ICACHE_FLASH_ATTR       scheduleWsTimer(WSConnection *connection, uint32_t ticks);
+static void ICACHE_FLASH_ATTR       cancelWsTimer(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       expireWsTimer(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       releaseWsConnection(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       reapWsConnection(WSConnection *connection);
+static void ICACHE_FLASH_ATTR       handleWsFrame(WSConnection *wsConnection, WSFrame *frame, char *lastByte);
+static WSServer *ICACHE_FLASH_ATTR  findWsServer(uint16_t port);
+static uint8_t ICACHE_FLASH_ATTR    nextWsTxSlot(WSConnection *connection, uint8_t slot);
+static uint8_t ICACHE_FLASH_ATTR    unmaskWsPayload(char *maskedPayload,
+                                                    uint32_t payloadLength,
+                                                    uint32_t maskingKey,
+                                                    uint8_t keyOffset);
+
+//servers that have begun listening
+static WSServer *wsServers;
+
+//the server behind the plain webSocket* functions, see defaultWsServer
+typedef WebSocketServer<WS_MAXCONN, WS_MAX_MESSAGE_SIZE, WS_TX_QUEUE_DEPTH> WSDefaultServer;
+
+//transmit buffer pools, indexed by WS_POOL_*, set up by the first beginWsServer
+static WSPool wsPools[WS_POOL_COUNT];
+static uint32_t wsPoolSmall[WSPOOL_STORAGE_WORDS(WS_POOL_SMALL_SIZE, WS_POOL_SMALL_COUNT)];
+static uint32_t wsPoolMedium[WSPOOL_STORAGE_WORDS(WS_POOL_MEDIUM_SIZE, WS_POOL_MEDIUM_COUNT)];
+static uint32_t wsPoolLarge[WSPOOL_STORAGE_WORDS(WS_POOL_LARGE_SIZE, WS_POOL_LARGE_COUNT)];
+
+#if WS_LOG_LEVEL > WS_LOG_NONE
+static WSLog wsLog;
+static char wsLogBuffer[WS_LOG_BUFFER_SIZE];
+static uint32_t wsLogDroppedReported;
+static const char wsLogLevels[] = "-EWID"; //indexed by WS_LOG_*
+#endif
+
+#if WS_DEFLATE
+//the compressor's match history and hash table, shared by every message
+//sent as compression never nests
+static uint16_t wsDeflateWork[WSDEFLATE_WORK_WORDS(WS_DEFLATE_WINDOW_BITS, WS_DEFLATE_MEM_LEVEL)];
+#endif
+
+#if WS_METRICS
+//WSMetrics counter index of each opcode
+static const uint8_t wsMetricsOpcodes[16] = { 0, 1, 2, 6, 6, 6, 6, 6, 3, 4, 5, 6, 6, 6, 6, 6 };
+#endif
+
+//indexed by HS_HEADER_*
+static const char *const wsHandshakeHeaders[HS_HEADER_COUNT] = {
+  "upgrade",
+  "connection",
+  "sec-websocket-key",
+  "sec-websocket-version",
+  "origin",
+  "sec-websocket-protocol",
+  "sec-websocket-extensions",
+  "sec-websocket-accept",
+};
 
-static void (*wsOnConnectionCallback)(void);
-static void (*wsOnMessageCallback)( char *payloadData );
+//***********************************************************************
+// Sets a server up to use the given slots and buffers: rxBuffers holds
+// maxConnections buffers of rxBufferSize + 1 bytes, txQueues maxConnections
+// queues of txQueueDepth entries.  inflateBuffer (rxBufferSize + 1 bytes) is
+// only needed with WS_DEFLATE, and subscribers (WS_MAX_TOPICS *
+// WS_SUBSCRIBER_WORDS(maxConnections) words) only for topics.
+void ICACHE_FLASH_ATTR initWsServer(WSServer *server,
+                                    uint16_t port,
+                                    WSConnection *connections,
+                                    uint8_t maxConnections,
+                                    char *rxBuffers,
+                                    uint16_t rxBufferSize,
+                                    WSTxBuffer **txQueues,
+                                    uint8_t txQueueDepth,
+                                    char *inflateBuffer,
+                                    uint32_t *subscribers) {
+  os_memset(server, 0, sizeof(WSServer));
+  server->port = port;
+  server->connections = connections;
+  server->maxConnections = maxConnections;
+  server->rxBufferSize = rxBufferSize;
+  server->txQueueDepth = txQueueDepth;
+  server->txHighWater = txQueueDepth * 3 / 4;
+  server->inflateBuffer = inflateBuffer;
+  if (subscribers != NULL) {
+    server->subscriberWords = WS_SUBSCRIBER_WORDS(maxConnections);
+    for (uint8_t topic = 0; topic < WS_MAX_TOPICS; topic++) {
+      server->topics[topic].subscribers = subscribers + topic * server->subscriberWords;
+    }
+  }
 
-static WSConnection wsConnections[WS_MAXCONN];
+  os_memset(connections, 0, maxConnections * sizeof(WSConnection));
+  for (uint8_t slotId = 0; slotId < maxConnections; slotId++) {
+    connections[slotId].server = server;
+    connections[slotId].rxBuffer = rxBuffers + slotId * (rxBufferSize + 1);
+    connections[slotId].txQueue = txQueues + slotId * txQueueDepth;
+  }
+}
 
 //***********************************************************************
-void ICACHE_FLASH_ATTR webSocketInit( void ) {
-    webSocketConn.type = ESPCONN_TCP;
-    webSocketConn.state = ESPCONN_NONE;
-    webSocketConn.proto.tcp = &webSocketTcp;
-    webSocketConn.proto.tcp->local_port = WEB_SOCKET_PORT;
-    espconn_regist_connectcb(&webSocketConn, webSocketConnectCb);
+void ICACHE_FLASH_ATTR beginWsServer(WSServer *server) {
+    server->listenConnection.type = ESPCONN_TCP;
+    server->listenConnection.state = ESPCONN_NONE;
+    server->listenConnection.proto.tcp = &server->listenTcp;
+    server->listenConnection.proto.tcp->local_port = server->port;
+    espconn_regist_connectcb(&server->listenConnection, webSocketConnectCb);
     
-    espconn_set_opt( &webSocketConn, ESPCONN_NODELAY );  // remove nagle for low latency
+    espconn_set_opt( &server->listenConnection, ESPCONN_NODELAY );  // remove nagle for low latency
+
+    registerWsServer(server);
     
-    sint8 ret = espconn_accept(&webSocketConn);
+    sint8 ret = espconn_accept(&server->listenConnection);
     if ( ret == 0 )
-        webSocketDebug("webSocket server established on port %d\n", WEB_SOCKET_PORT );
+        wsLogInfo("webSocket server established on port %d\n", server->port);
     else
-        webSocketDebug("webSocket server on port %d FAILED ret=%d\n", WEB_SOCKET_PORT, ret);
+        wsLogError("webSocket server on port %d FAILED ret=%d\n", server->port, ret);
     
     return;
 }
 
 //***********************************************************************
+// The server listening on port.  Accepted connections report the port they
+// came in on as their local port.
+static WSServer *ICACHE_FLASH_ATTR findWsServer(uint16_t port) {
+  for (WSServer *server = wsServers; server != NULL; server = server->next) {
+    if (server->port == port && !server->isClient) {
+      return server;
+    }
+  }
+  return NULL;
+}
+
+//***********************************************************************
+// Adds a server, or client, to the list searched by getWsConnection and
+// starts its keepalive timer.  The transmit buffer pools are set up with
+// the first one.
+static void ICACHE_FLASH_ATTR registerWsServer(WSServer *server) {
+  if (wsPools[WS_POOL_SMALL].blocks == NULL) {
+    initWsPools();
+  }
+
+  WSServer *registered = wsServers;
+  while (registered != NULL && registered != server) {
+    registered = registered->next;
+  }
+  if (registered == NULL) {
+    server->next = wsServers;
+    wsServers = server;
+  }
+
+  os_timer_disarm(&server->timer);
+  os_timer_setfn(&server->timer, webSocketTimerCb, server);
+  os_timer_arm(&server->timer, WS_TIMER_TICK, 1);
+}
+
+//***********************************************************************
+// Starts connecting a client to the websocket server at ip:port.  host and
+// path go into the upgrade request, which is sent once the tcp connection
+// is up; they must stay put until then.  The connection callback is called
+// when the server has accepted the upgrade.
+sint8 ICACHE_FLASH_ATTR connectWsClient(WSServer *client, const uint8_t ip[4], uint16_t port, const char *host, const char *path) {
+  WSConnection *wsConnection = &client->connections[0];
+  if (wsConnection->connection != NULL) {
+    return ESPCONN_ISCONN;
+  }
+
+  client->host = host;
+  client->path = path;
+
+  struct espconn *connection = &client->listenConnection;
+  os_memset(&client->listenTcp, 0, sizeof(client->listenTcp));
+  connection->type = ESPCONN_TCP;
+  connection->state = ESPCONN_NONE;
+  connection->proto.tcp = &client->listenTcp;
+  connection->proto.tcp->local_port = espconn_port();
+  connection->proto.tcp->remote_port = port;
+  os_memcpy(connection->proto.tcp->remote_ip, ip, 4);
+  espconn_regist_connectcb(connection, webSocketClientConnectCb);
+
+  registerWsServer(client);
+  openWsSlot(wsConnection, connection);
+
+  sint8 ret = espconn_connect(connection);
+  if (ret != 0) {
+    wsLogError("webSocket connect to %d.%d.%d.%d:%d FAILED ret=%d\n", ip[0], ip[1], ip[2], ip[3], port, ret);
+    releaseWsConnection(wsConnection);
+  }
+  return ret;
+}
+
+//***********************************************************************
+// The client's tcp connection is up: send the upgrade request, with a
+// fresh random key.
+void ICACHE_FLASH_ATTR webSocketClientConnectCb(void *arg) {
+  WSConnection *wsConnection = getWsConnection((struct espconn *)arg);
+  if (wsConnection == NULL) {
+    return;
+  }
+  WSServer *client = wsConnection->server;
+  WSHandshake *hs = &wsConnection->handshake;
+
+  uint8_t nonce[WS_NONCE_LENGTH];
+  for (uint8_t i = 0; i < WS_NONCE_LENGTH; i += 4) {
+    uint32_t random = os_random();
+    os_memcpy(nonce + i, &random, 4);
+  }
+  base64_encode(WS_NONCE_LENGTH, nonce, sizeof(hs->key), hs->key);
+
+  char request[WS_HANDSHAKE_MAX_RESPONSE];
+  int length = os_snprintf(request, sizeof(request), WS_REQUEST, client->path, client->host, hs->key);
+  if (length > 0 && length < (int)sizeof(request) && client->protocol != NULL) {
+    length += os_snprintf(request + length, sizeof(request) - length, WS_RESPONSE_PROTOCOL, client->protocol);
+  }
+  if (length <= 0 || length + 2 >= (int)sizeof(request)) {
+    wsLogError("webSocket upgrade request too long\n");
+    wsConnection->status = STATUS_CLOSED;
+    espconn_disconnect(wsConnection->connection);
+    return;
+  }
+  length += os_sprintf(request + length, HTML_HEADER_LINEEND);
+
+  sendWsRaw(wsConnection, request, length);
+}
+
+//***********************************************************************
+// The default server is made the first time one of the plain webSocket*
+// functions is called, rather than at start up, so an application that
+// only uses WebSocketServer<> instances doesn't reference it and the
+// linker leaves its RAM out.
+static WSDefaultServer &ICACHE_FLASH_ATTR defaultWsServer( void ) {
+  static WSDefaultServer server;
+  return server;
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR webSocketInit( void ) {
+    defaultWsServer().txHighWater = WS_TX_HIGH_WATER;
+    defaultWsServer().begin();
+}
+
+//***********************************************************************
+// Receives every message as a NUL terminated string, which, like a view, is
+// only valid until the callback returns.
 void ICACHE_FLASH_ATTR webSocketSetReceiveCallback( void (*onMessage)( char *payloadData) ) {
-    wsOnMessageCallback = onMessage;
+    defaultWsServer().setReceiveCallback(onMessage);
+}
+
+//***********************************************************************
+// Receives every message with its connection, opcode and length, plus the
+// userContext given here.  The payload is not NUL terminated.
+void ICACHE_FLASH_ATTR webSocketSetDataCallback( WSOnData onData, void *userContext ) {
+    defaultWsServer().setDataCallback(onData, userContext);
+}
+
+//***********************************************************************
+// Lends every message to onView without copying it, see WSView; the
+// callback keeps what it needs with retainWsView.  userContext is its own,
+// independent of the data callback's.
+void ICACHE_FLASH_ATTR webSocketSetViewCallback( WSOnView onView, void *userContext ) {
+    defaultWsServer().setViewCallback(onView, userContext);
+}
+
+//***********************************************************************
+// Called when a connection's transmit queue fills up to WS_TX_HIGH_WATER
+// frames, so producers can back off before sends start to fail.
+void ICACHE_FLASH_ATTR webSocketSetHighWaterCallback( WSOnHighWater onHighWater ) {
+    defaultWsServer().setHighWaterCallback(onHighWater);
+}
+
+//***********************************************************************
+// Lets the application refuse upgrade requests based on their Origin header.
+// The origin is not NUL terminated.
+void ICACHE_FLASH_ATTR webSocketSetOriginCallback( WSOnOrigin onOrigin ) {
+    defaultWsServer().setOriginCallback(onOrigin);
+}
+
+//***********************************************************************
+// The subprotocol to accept when a client offers it in Sec-WebSocket-Protocol.
+void ICACHE_FLASH_ATTR webSocketSetProtocol( const char *protocol ) {
+    defaultWsServer().setProtocol(protocol);
+}
+
+//***********************************************************************
+// Lets clients subscribe themselves to topics with WS_SUBSCRIBE and
+// WS_UNSUBSCRIBE messages.  Off by default, so no message is taken away
+// from the application unless it asks for this.
+void ICACHE_FLASH_ATTR webSocketSetSubscriptionMessages( bool enabled ) {
+    defaultWsServer().setSubscriptionMessages(enabled);
 }
 
 //***********************************************************************
 void ICACHE_FLASH_ATTR webSocketSetConnectionCallback( void (*onConnection)(void) ) {
-    wsOnConnectionCallback = onConnection;
+    defaultWsServer().setConnectionCallback(onConnection);
 }
 
 //***********************************************************************
 void ICACHE_FLASH_ATTR webSocketConnectCb(void *arg) {
   struct espconn *connection = (espconn *)arg;
 
-  webSocketDebug("\n\nmeshWebSocket received connection !!!\n");
+  wsLogDebug("webSocket connection from %d.%d.%d.%d:%d\n", connection->proto.tcp->remote_ip[0],
+             connection->proto.tcp->remote_ip[1], connection->proto.tcp->remote_ip[2],
+             connection->proto.tcp->remote_ip[3], connection->proto.tcp->remote_port);
 
     // set time out for this connection in seconds
-    espconn_regist_time( connection, 120, 1);
+    espconn_regist_time( connection, CONN_TIMEOUT, 1);
+
+  WSServer *server = findWsServer(connection->proto.tcp->local_port);
+  if (server == NULL) {
+    //only one server is normally running
+    server = wsServers;
+    while (server != NULL && server->isClient) {
+      server = server->next;
+    }
+    if (server == NULL) {
+      espconn_disconnect(connection);
+      return;
+    }
+  }
     
-  //find an empty slot
+  //find an empty slot.  Slots are freed when their tcp connection goes,
+  //or is reaped by the keepalive timer
   uint8_t slotId = 0;
-  while (wsConnections[slotId].connection != NULL && wsConnections[slotId].status != STATUS_CLOSED && slotId < WS_MAXCONN) {
+  while (slotId < server->maxConnections && server->connections[slotId].connection != NULL) {
     slotId++;
   }
 
-  webSocketDebug("websocketConnectCb slotId=%d\n", slotId);
+  wsLogDebug("webSocket slotId=%d\n", slotId);
 
 
-  if (slotId >= WS_MAXCONN) {
+  if (slotId >= server->maxConnections) {
     //no more free slots, close the connection
-    webSocketDebug("No more free slots for WebSockets!\n");
+    wsLogWarn("No more free slots for WebSockets!\n");
+#if WS_METRICS
+    server->metrics.slotRejections++;
+#endif
     espconn_disconnect(connection);
     return;
   }
 
-  //  webSocketDebug("websocketConnectCb2\n");
-
-  WSConnection wsConnection;
-  wsConnection.status = STATUS_UNINITIALISED;
-  wsConnection.connection = connection;
-  wsConnection.onMessage = wsOnMessageCallback;
-  wsConnections[slotId] = wsConnection;
+  openWsSlot(&server->connections[slotId], connection);
+#if WS_METRICS
+  server->metrics.accepted++;
+#endif
+}
 
-  //  webSocketDebug("websocketConnectCb3\n");
+//***********************************************************************
+// Readies a slot for a new tcp connection, accepted or outgoing, which
+// has until WS_HANDSHAKE_TIMEOUT to complete the upgrade.
+static void ICACHE_FLASH_ATTR openWsSlot(WSConnection *wsConnection, struct espconn *connection) {
+  WSServer *server = wsConnection->server;
+
+  cancelWsTimer(wsConnection);
+  wsConnection->status = STATUS_UNINITIALISED;
+  wsConnection->connection = connection;
+  os_memcpy(wsConnection->remoteIp, connection->proto.tcp->remote_ip, sizeof(wsConnection->remoteIp));
+  wsConnection->remotePort = connection->proto.tcp->remote_port;
+  connection->reverse = wsConnection;
+  wsConnection->onMessage = server->onMessage;
+  wsConnection->onData = server->onData;
+  wsConnection->onView = server->onView;
+  wsConnection->userContext = server->onDataContext;
+  wsConnection->viewContext = server->onViewContext;
+  os_memset(&wsConnection->handshake, 0, sizeof(wsConnection->handshake));
+  wsConnection->deflateWindowBits = 0;
+  wsConnection->rxState = RX_STATE_HEADER;
+  wsConnection->rxHeaderLength = 0;
+  wsConnection->rxMessageOpcode = OPCODE_CONTINUE;
+  wsConnection->rxMessageCompressed = false;
+  wsConnection->rxMessageLength = 0;
+  flushWsTxQueue(wsConnection);
+  wsConnection->pingsUnanswered = 0;
+  wsConnection->roundTripTime = 0;
+  scheduleWsTimer(wsConnection, WS_HANDSHAKE_TIMEOUT);
+#if WS_METRICS
+  wsConnection->acceptedAt = system_get_time();
+#endif
 
   espconn_regist_recvcb(connection, webSocketRecvCb);
   espconn_regist_sentcb(connection, webSocketSentCb);
   espconn_regist_reconcb(connection, webSocketReconCb);
   espconn_regist_disconcb(connection, webSocketDisconCb);
-
-  //  webSocketDebug("leaving websocketConnectCb\n");
 }
 
 //***********************************************************************
@@ -96,268 +451,2057 @@ void ICACHE_FLASH_ATTR webSocketRecvCb(void *arg, char *data, unsigned short len
   espconn *esp_connection = (espconn*)arg;
 
   //received some data from webSocket connection
-  //webSocketDebug("In webSocketRecvCb\n");
-  //  webSocketDebug("webSocket recv--->%s<----\n", data);
 
   WSConnection *wsConnection = getWsConnection(esp_connection);
   if (wsConnection == NULL) {
-    webSocketDebug("webSocket Heh?\n");
+    wsLogWarn("webSocket data for an unknown connection\n");
     return;
   }
 
-  //get the first occurrence of the key identifier
-  char *key = os_strstr(data, WS_KEY_IDENTIFIER);
-
-  //  webSocketDebug("key-->%s<--\n", key );
+  resumeWsTx(wsConnection);
 
-  if (key != NULL) {
+  if (wsConnection->status == STATUS_UNINITIALISED) {
     // ------------------------ Handle the Handshake ------------------------
-    //    webSocketDebug("In Handle the Handshake\n");
-    //Skip the identifier (that contains the space already)
-    key += os_strlen(WS_KEY_IDENTIFIER);
+    uint32_t used = feedWsHandshake(wsConnection, data, len);
+    data += used;
+    len -= used;
+  }
 
-    //   webSocketDebug("keynow-->%s<--\n", key);
+  if (wsConnection->status == STATUS_OPEN) {
+    // ------------------------ Handle Frames ------------------------
+    //a segment can hold any number of frames, or only a piece of one
+    feedWsFrames(wsConnection, data, len);
+  }
+}
 
-    //the key ends at the newline
-    char *endSequence = os_strstr(key, HTML_HEADER_LINEEND);
-    //    webSocketDebug("endSequency-->%s<--\n", endSequence);
+//***********************************************************************
+// Incremental HTTP upgrade request parser, a byte at a time so requests may
+// be split anywhere.  Header names are matched lower cased against the few
+// we care about and only those values are kept, in hsValue.  Returns the
+// number of bytes consumed, which is less than len if the request ended
+// inside the segment.
+static uint32_t ICACHE_FLASH_ATTR feedWsHandshake(WSConnection *wsConnection, char *data, uint32_t len) {
+  WSHandshake *hs = &wsConnection->handshake;
+  uint32_t i;
+
+  for (i = 0; i < len && wsConnection->status == STATUS_UNINITIALISED; i++) {
+    char c = data[i];
+
+    if (c == '\r') {
+      continue;
+    }
 
-    if (endSequence != NULL) {
-      int keyLastChar = endSequence - key;
-      //we can throw away all the other data, only the key is interesting
-      key[keyLastChar] = '\0';
-      //      webSocketDebug("keyTrimmed-->%s<--\n", key);
+    switch (hs->state) {
+      case HS_STATE_REQUEST_LINE:
+        //only the method matters, or for a client the response's status code
+        if (hs->valueLength < sizeof(WS_STATUS_101) - 1) {
+          hs->value[hs->valueLength++] = c;
+        }
+        if (c == '\n') {
+          if (wsConnection->server->isClient) {
+            if (hs->valueLength < sizeof(WS_STATUS_101) - 1 ||
+                os_memcmp(hs->value, WS_STATUS_101, sizeof(WS_STATUS_101) - 1) != 0) {
+              hs->flags |= HS_FLAG_BAD_RESPONSE;
+              finishWsClientHandshake(wsConnection);
+              break;
+            }
+          } else if (hs->valueLength < 4 || os_memcmp(hs->value, "GET ", 4) != 0) {
+            rejectWsHandshake(wsConnection, WS_RESPONSE_400);
+            break;
+          }
+          hs->state = HS_STATE_NAME;
+          hs->nameLength = 0;
+        }
+        break;
+
+      case HS_STATE_NAME:
+        if (c == '\n') {
+          if (hs->nameLength == 0) {
+            //empty line, the end of the request
+            if (wsConnection->server->isClient) {
+              finishWsClientHandshake(wsConnection);
+            } else {
+              finishWsHandshake(wsConnection);
+            }
+          }
+          hs->nameLength = 0; //a line without a colon is ignored
+        } else if (c == ':') {
+          hs->header = matchWsHandshakeHeader(hs->name, hs->nameLength);
+          hs->valueLength = 0;
+          hs->state = HS_STATE_VALUE;
+        } else if (hs->nameLength < sizeof(hs->name)) {
+          hs->name[hs->nameLength++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        } else {
+          hs->nameLength = sizeof(hs->name) + 1; //too long for any header we know
+        }
+        break;
+
+      case HS_STATE_VALUE:
+        if (c == '\n') {
+          //trailing white space is not part of the value
+          while (hs->valueLength > 0 && hs->value[hs->valueLength - 1] == ' ') {
+            hs->valueLength--;
+          }
+          if (wsConnection->server->isClient) {
+            takeWsResponseHeader(wsConnection);
+          } else {
+            takeWsHandshakeHeader(wsConnection);
+          }
+          hs->nameLength = 0;
+          hs->state = HS_STATE_NAME;
+        } else if (hs->header != HS_HEADER_NONE && (hs->valueLength > 0 || c != ' ')) {
+          if (hs->valueLength < WS_HANDSHAKE_MAX_VALUE) {
+            hs->value[hs->valueLength++] = c;
+          } else if (hs->header == HS_HEADER_EXTENSIONS) {
+            //a truncated offer can't be trusted, decline the lot
+            hs->header = HS_HEADER_NONE;
+          } else if (hs->header == HS_HEADER_ORIGIN || hs->header == HS_HEADER_PROTOCOL) {
+            //only a prefix could be checked, which may pass where the whole
+            //wouldn't.  A value nothing checks is just skipped; a client
+            //checks every protocol the server picks.
+            WSServer *server = wsConnection->server;
+            if ((hs->header == HS_HEADER_ORIGIN && server->onOrigin != NULL) ||
+                (hs->header == HS_HEADER_PROTOCOL && (server->protocol != NULL || server->isClient))) {
+              hs->flags |= HS_FLAG_TOO_LONG;
+            }
+            hs->header = HS_HEADER_NONE;
+          }
+        }
+        break;
+    }
+  }
 
-      char acceptKey[100];
-      createWsAcceptKey(key, acceptKey, 100);
+  return i;
+}
 
-      //     webSocketDebug("acceptKey-->%s<--\n", acceptKey);
+//***********************************************************************
+static uint8_t ICACHE_FLASH_ATTR matchWsHandshakeHeader(const char *name, uint8_t nameLength) {
+  for (uint8_t header = 0; header < HS_HEADER_COUNT; header++) {
+    if (os_strlen(wsHandshakeHeaders[header]) == nameLength &&
+        os_memcmp(wsHandshakeHeaders[header], name, nameLength) == 0) {
+      return header;
+    }
+  }
+  return HS_HEADER_NONE;
+}
 
-      //now construct our message and send it back to the client
-      char responseMessage[strlen(WS_RESPONSE) + 100];
-      os_sprintf(responseMessage, WS_RESPONSE, acceptKey);
+//***********************************************************************
+// Records what we need from a complete header value.
+static void ICACHE_FLASH_ATTR takeWsHandshakeHeader(WSConnection *wsConnection) {
+  WSHandshake *hs = &wsConnection->handshake;
+
+  switch (hs->header) {
+    case HS_HEADER_UPGRADE:
+      if (hasWsToken(hs->value, hs->valueLength, "websocket")) {
+        hs->flags |= HS_FLAG_UPGRADE;
+      }
+      break;
 
-      //      webSocketDebug("responseMessage-->%s<--\n", responseMessage);
+    case HS_HEADER_CONNECTION:
+      if (hasWsToken(hs->value, hs->valueLength, "upgrade")) {
+        hs->flags |= HS_FLAG_CONNECTION;
+      }
+      break;
 
-      //send the response
-      espconn_sent(esp_connection, (uint8_t *)responseMessage, strlen(responseMessage));
-      wsConnection->status = STATUS_OPEN;
+    case HS_HEADER_KEY:
+      if (hs->valueLength == WS_KEY_LENGTH) {
+        os_memcpy(hs->key, hs->value, WS_KEY_LENGTH);
+        hs->key[WS_KEY_LENGTH] = '\0';
+        hs->flags |= HS_FLAG_KEY;
+      }
+      break;
 
-      //call the connection callback
-      if (wsOnConnectionCallback != NULL) {
-        //       webSocketDebug("Handle the Handshake 5\n");
-        wsOnConnectionCallback();
+    case HS_HEADER_VERSION:
+      if (hs->valueLength == 2 && hs->value[0] == '1' && hs->value[1] == '3') {
+        hs->flags |= HS_FLAG_VERSION;
+      } else {
+        hs->flags |= HS_FLAG_BAD_VERSION;
       }
-    }
-  } else {
-    // ------------------------ Handle a Frame ------------------------
-    //    webSocketDebug("In Handle a Frame\n");
+      break;
 
-    WSFrame frame;
-    parseWsFrame(data, &frame);
+    case HS_HEADER_ORIGIN:
+      if (wsConnection->server->onOrigin != NULL && !wsConnection->server->onOrigin(hs->value, hs->valueLength)) {
+        hs->flags |= HS_FLAG_BAD_ORIGIN;
+      }
+      break;
 
-    if (frame.isMasked) {
-      unmaskWsPayload(frame.payloadData, frame.payloadLength, frame.maskingKey);
-    } else {
-      //we are the server, and need to shut down the connection
-      //if we receive an unmasked packet
-      //      webSocketDebug("frame.isMasked=false closing connection\n");
-      closeWsConnection(wsConnection);
-      return;
-    }
+    case HS_HEADER_PROTOCOL:
+      if (wsConnection->server->protocol != NULL && hasWsToken(hs->value, hs->valueLength, wsConnection->server->protocol)) {
+        hs->flags |= HS_FLAG_PROTOCOL;
+      }
+      break;
 
-//    webSocketDebug("frame.payloadData-->%s<--\n", frame.payloadData);
+    case HS_HEADER_EXTENSIONS:
+#if WS_DEFLATE
+      if (hs->deflateWindowBits == 0 && wsConnection->server->inflateBuffer != NULL) {
+        hs->deflateWindowBits = parseWsDeflateOffers(hs->value, hs->valueLength);
+      }
+#endif
+      break;
+  }
+}
 
-    if (frame.opcode == OPCODE_PING) {
-      //      webSocketDebug("frame.opcode=OPCODE_PING\n");
-      sendWsMessage(wsConnection, frame.payloadData, frame.payloadLength, FLAG_FIN | OPCODE_PONG);
-      return;
-    }
+//***********************************************************************
+// Records what a client needs from a complete header of the server's
+// response.  The server mustn't pick a protocol or extension we didn't
+// ask for (RFC 6455 section 4.1), and we ask for no extensions.
+static void ICACHE_FLASH_ATTR takeWsResponseHeader(WSConnection *wsConnection) {
+  WSHandshake *hs = &wsConnection->handshake;
+  char acceptKey[32];
+
+  switch (hs->header) {
+    case HS_HEADER_UPGRADE:
+      if (hasWsToken(hs->value, hs->valueLength, "websocket")) {
+        hs->flags |= HS_FLAG_UPGRADE;
+      }
+      break;
 
-    if (frame.opcode == OPCODE_CLOSE) {
-      //gracefully shut down the connection
-      //      webSocketDebug("frame.opcode=OPCODE_CLOSE, closeing connection\n");
-      closeWsConnection(wsConnection);
-      return;
+    case HS_HEADER_CONNECTION:
+      if (hasWsToken(hs->value, hs->valueLength, "upgrade")) {
+        hs->flags |= HS_FLAG_CONNECTION;
+      }
+      break;
+
+    case HS_HEADER_ACCEPT:
+      createWsAcceptKey(hs->key, acceptKey, sizeof(acceptKey));
+      if (hs->valueLength == 28 && os_memcmp(hs->value, acceptKey, 28) == 0) {
+        hs->flags |= HS_FLAG_ACCEPT;
+      } else {
+        hs->flags |= HS_FLAG_BAD_RESPONSE;
+      }
+      break;
+
+    case HS_HEADER_PROTOCOL:
+      if (wsConnection->server->protocol == NULL ||
+          !hasWsToken(hs->value, hs->valueLength, wsConnection->server->protocol)) {
+        hs->flags |= HS_FLAG_BAD_RESPONSE;
+      }
+      break;
+
+    case HS_HEADER_EXTENSIONS:
+      hs->flags |= HS_FLAG_BAD_RESPONSE;
+      break;
+  }
+}
+
+//***********************************************************************
+// Case insensitive search for token in a comma separated header value.
+static bool ICACHE_FLASH_ATTR hasWsToken(const char *list, uint8_t listLength, const char *token) {
+  uint8_t tokenLength = os_strlen(token);
+  uint8_t i = 0;
+
+  while (i < listLength) {
+    while (i < listLength && (list[i] == ' ' || list[i] == ',')) {
+      i++;
+    }
+    uint8_t start = i;
+    while (i < listLength && list[i] != ',') {
+      i++;
+    }
+    uint8_t end = i;
+    while (end > start && list[end - 1] == ' ') {
+      end--;
     }
 
-    if (wsConnection->onMessage != NULL) {
-      wsConnection->onMessage(frame.payloadData);
+    if (end - start == tokenLength) {
+      uint8_t j = 0;
+      while (j < tokenLength && (list[start + j] | 0x20) == (token[j] | 0x20)) {
+        j++;
+      }
+      if (j == tokenLength) {
+        return true;
+      }
     }
   }
-  //  webSocketDebug("Leaving webSocketRecvCb\n");
+  return false;
 }
 
+#if WS_DEFLATE
 //***********************************************************************
-static void ICACHE_FLASH_ATTR unmaskWsPayload(char *maskedPayload,
-                                              uint32_t payloadLength,
-                                              uint32_t maskingKey) {
-  //the algorith described in IEEE RFC 6455 Section 5.3
-  //TODO: this should decode the payload 4-byte wise and do the remainder afterwards
-  for (int i = 0; i < payloadLength; i++) {
-    int j = i % 4;
-    maskedPayload[i] = maskedPayload[i] ^ ((uint8_t *)&maskingKey)[j];
+// Looks through a Sec-WebSocket-Extensions value for the first
+// permessage-deflate offer we can accept.  Returns the window bits to
+// compress with, or 0 if there is none.
+static uint8_t ICACHE_FLASH_ATTR parseWsDeflateOffers(const char *list, uint8_t listLength) {
+  uint8_t start = 0;
+
+  while (start < listLength) {
+    uint8_t end = start;
+    while (end < listLength && list[end] != ',') {
+      end++;
+    }
+    uint8_t windowBits = parseWsDeflateOffer(list + start, end - start);
+    if (windowBits != 0) {
+      return windowBits;
+    }
+    start = end + 1;
   }
+  return 0;
 }
 
 //***********************************************************************
-static void ICACHE_FLASH_ATTR parseWsFrame(char *data, WSFrame *frame) {
-  frame->flags = (*data) & FLAGS_MASK;
-  frame->opcode = (*data) & OPCODE_MASK;
-  //next byte
-  data += 1;
-  frame->isMasked = (*data) & IS_MASKED;
-  frame->payloadLength = (*data) & PAYLOAD_MASK;
+// Checks one offer, "permessage-deflate" followed by ';' separated
+// parameters (RFC 7692 section 7.1).  We always answer with both
+// no_context_takeover parameters, so all the client can ask of us is a
+// smaller window.  Unknown, repeated or malformed parameters decline the
+// offer.
+static uint8_t ICACHE_FLASH_ATTR parseWsDeflateOffer(const char *offer, uint8_t offerLength) {
+  uint8_t windowBits = WS_DEFLATE_WINDOW_BITS;
+  uint8_t seen = 0;
+  uint8_t start = 0;
+
+  for (uint8_t param = 0; start <= offerLength; param++) {
+    uint8_t end = start;
+    while (end < offerLength && offer[end] != ';') {
+      end++;
+    }
+    const char *name = offer + start;
+    uint8_t length = end - start;
+    start = end + 1;
+
+    if (param == 0) {
+      if (!hasWsToken(name, length, "permessage-deflate")) {
+        return 0;
+      }
+      continue;
+    }
 
-  //next byte
-  data += 1;
+    uint8_t nameLength = 0;
+    while (nameLength < length && name[nameLength] != '=') {
+      nameLength++;
+    }
+    bool hasValue = nameLength < length;
+    uint8_t bits = 0;
+    if (hasValue) {
+      bits = parseWsWindowBits(name + nameLength + 1, length - nameLength - 1);
+      if (bits == 0) {
+        return 0;
+      }
+    }
 
-  if (frame->payloadLength == 126) {
-    os_memcpy(&frame->payloadLength, data, sizeof(uint16_t));
-    data += sizeof(uint16_t);
-  } else if (frame->payloadLength == 127) {
-    os_memcpy(&frame->payloadLength, data, sizeof(uint64_t));
-    data += sizeof(uint64_t);
-  }
+    uint8_t mask;
+    if (!hasValue && hasWsToken(name, nameLength, "server_no_context_takeover")) {
+      mask = 1 << 0;
+    } else if (!hasValue && hasWsToken(name, nameLength, "client_no_context_takeover")) {
+      mask = 1 << 1;
+    } else if (hasValue && hasWsToken(name, nameLength, "server_max_window_bits")) {
+      mask = 1 << 2;
+      if (bits < windowBits) {
+        windowBits = bits;
+      }
+    } else if (hasWsToken(name, nameLength, "client_max_window_bits")) {
+      //we can inflate any window, so there is nothing to limit
+      mask = 1 << 3;
+    } else {
+      return 0;
+    }
 
-  if (frame->isMasked) {
-    os_memcpy(&frame->maskingKey, data, sizeof(uint32_t));
-    data += sizeof(uint32_t);
+    if (seen & mask) {
+      return 0;
+    }
+    seen |= mask;
   }
 
-  frame->payloadData = data;
+  return windowBits;
 }
 
 //***********************************************************************
-WSConnection *ICACHE_FLASH_ATTR getWsConnection(struct espconn *connection) {
-//  webSocketDebug("In getWsConnecition\n");
-  for (int slotId = 0; slotId < WS_MAXCONN; slotId++) {
-//    webSocketDebug("slotId=%d, ws.conn*=%x, espconn*=%x<--  ", slotId, wsConnections[slotId].connection, connection);
+// A window bits value, 8 to 15 and possibly quoted.  Returns 0 if invalid.
+static uint8_t ICACHE_FLASH_ATTR parseWsWindowBits(const char *value, uint8_t valueLength) {
+  uint8_t bits = 0;
 
-    //    webSocketDebug("ws.connIP=%d.%d.%d.%d espconnIP=%d.%d.%d.%d --- ", IP2STR( wsConnections[slotId].connection->proto.tcp->remote_ip), IP2STR( connection->proto.tcp->remote_ip) );
-//    webSocketDebug("ws.connIP=%x espconnIP=%x\n", *(uint32_t*)wsConnections[slotId].connection->proto.tcp->remote_ip, *(uint32_t*)connection->proto.tcp->remote_ip ) ;
+  while (valueLength > 0 && *value == ' ') {
+    value++;
+    valueLength--;
+  }
+  while (valueLength > 0 && value[valueLength - 1] == ' ') {
+    valueLength--;
+  }
+  if (valueLength >= 2 && value[0] == '"' && value[valueLength - 1] == '"') {
+    value++;
+    valueLength -= 2;
+  }
+  if (valueLength == 0 || valueLength > 2) {
+    return 0;
+  }
 
-    //   if (wsConnections[slotId].connection == connection) {
-    if (*(uint32_t*)wsConnections[slotId].connection->proto.tcp->remote_ip == *(uint32_t*)connection->proto.tcp->remote_ip ) {
- //     webSocketDebug("Leaving getWsConnecition slotID=%d\n", slotId);
-      return wsConnections + slotId;
+  for (uint8_t i = 0; i < valueLength; i++) {
+    if (value[i] < '0' || value[i] > '9') {
+      return 0;
     }
+    bits = bits * 10 + (value[i] - '0');
   }
-
-//  webSocketDebug("Leaving getWsConnecition w/ NULL\n");
-  return NULL;
+  return (bits >= 8 && bits <= 15) ? bits : 0;
 }
+#endif
 
 //***********************************************************************
-static int ICACHE_FLASH_ATTR createWsAcceptKey(const char *key, char *buffer, int bufferSize) {
-  sha1nfo s;
+// The request is complete: check it and either accept the upgrade or
+// answer with an error.
+static void ICACHE_FLASH_ATTR finishWsHandshake(WSConnection *wsConnection) {
+  WSHandshake *hs = &wsConnection->handshake;
 
-  char concatenatedBuffer[512];
-  concatenatedBuffer[0] = '\0';
-  //concatenate the key and the GUID
-  os_strcat(concatenatedBuffer, key);
-  os_strcat(concatenatedBuffer, WS_GUID);
+  if (hs->flags & HS_FLAG_BAD_VERSION) {
+    rejectWsHandshake(wsConnection, WS_RESPONSE_426);
+    return;
+  }
+  if (hs->flags & HS_FLAG_BAD_ORIGIN) {
+    rejectWsHandshake(wsConnection, WS_RESPONSE_403);
+    return;
+  }
+  if ((hs->flags & HS_FLAG_TOO_LONG) || (hs->flags & HS_FLAGS_REQUIRED) != HS_FLAGS_REQUIRED) {
+    rejectWsHandshake(wsConnection, WS_RESPONSE_400);
+    return;
+  }
 
-  //build the sha1 hash
-  sha1_init(&s);
-  sha1_write(&s, concatenatedBuffer, strlen(concatenatedBuffer));
-  uint8_t *hash = sha1_result(&s);
+  char acceptKey[32];
+  createWsAcceptKey(hs->key, acceptKey, sizeof(acceptKey));
 
-  return base64_encode(20, hash, bufferSize, buffer);
+  //now construct our message and send it back to the client
+  char responseMessage[WS_HANDSHAKE_MAX_RESPONSE];
+  int length = os_sprintf(responseMessage, WS_RESPONSE, acceptKey);
+  if (hs->flags & HS_FLAG_PROTOCOL) {
+    length += os_sprintf(responseMessage + length, WS_RESPONSE_PROTOCOL, wsConnection->server->protocol);
+  }
+  if (hs->deflateWindowBits != 0) {
+    length += os_sprintf(responseMessage + length, WS_RESPONSE_DEFLATE, hs->deflateWindowBits);
+    wsConnection->deflateWindowBits = hs->deflateWindowBits;
+  }
+  length += os_sprintf(responseMessage + length, HTML_HEADER_LINEEND);
+
+  //send the response
+  sendWsRaw(wsConnection, responseMessage, length);
+  wsConnection->status = STATUS_OPEN;
+#if WS_METRICS
+  wsConnection->metrics.handshakeTime = system_get_time() - wsConnection->acceptedAt;
+#endif
+  scheduleWsTimer(wsConnection, WS_PING_INTERVAL);
+
+  //call the connection callback
+  if (wsConnection->server->onConnection != NULL) {
+    wsConnection->server->onConnection();
+  }
 }
 
 //***********************************************************************
-void ICACHE_FLASH_ATTR closeWsConnection(WSConnection * connection) {
-  //  webSocketDebug("In closeWsConnection\n");
+// The server's response is complete, or its status line was wrong: open
+// the connection if the upgrade was accepted, otherwise drop it.
+static void ICACHE_FLASH_ATTR finishWsClientHandshake(WSConnection *wsConnection) {
+  WSHandshake *hs = &wsConnection->handshake;
+
+  if ((hs->flags & (HS_FLAG_BAD_RESPONSE | HS_FLAG_TOO_LONG)) ||
+      (hs->flags & HS_FLAGS_CLIENT_REQUIRED) != HS_FLAGS_CLIENT_REQUIRED) {
+    wsLogWarn("webSocket upgrade refused by the server\n");
+#if WS_METRICS
+    wsConnection->server->metrics.handshakeRejections++;
+#endif
+    wsConnection->status = STATUS_CLOSED;
+    espconn_disconnect(wsConnection->connection);
+    return;
+  }
 
-  char closeMessage[CLOSE_MESSAGE_LENGTH] = CLOSE_MESSAGE;
-  espconn_sent(connection->connection, (uint8_t *)closeMessage, sizeof(closeMessage));
-  connection->status = STATUS_CLOSED;
-  return;
+  wsConnection->status = STATUS_OPEN;
+#if WS_METRICS
+  wsConnection->metrics.handshakeTime = system_get_time() - wsConnection->acceptedAt;
+#endif
+  scheduleWsTimer(wsConnection, WS_PING_INTERVAL);
+
+  if (wsConnection->server->onConnection != NULL) {
+    wsConnection->server->onConnection();
+  }
 }
 
 //***********************************************************************
-void ICACHE_FLASH_ATTR broadcastWsMessage(const char *payload, uint32_t payloadLength, uint8_t options) {
-    //webSocketDebug("broadcastWsMessage-->%s<-- payloadLength=%d\n", payload, payloadLength);
-    for (int slotId = 0; slotId < WS_MAXCONN; slotId++) {
-        WSConnection connection = wsConnections[slotId];
-        if (connection.connection != NULL && connection.status == STATUS_OPEN) {
-            sendWsMessage(&connection, payload, payloadLength, options);
-        }
-    }
+// Answers a bad upgrade request.  The tcp connection is closed once the
+// response has gone.
+static void ICACHE_FLASH_ATTR rejectWsHandshake(WSConnection *wsConnection, const char *response) {
+  wsLogWarn("webSocket handshake rejected\n");
+#if WS_METRICS
+  wsConnection->server->metrics.handshakeRejections++;
+#endif
+  sendWsRaw(wsConnection, response, os_strlen(response));
+  wsConnection->status = STATUS_CLOSED;
+  disconnectWsIfIdle(wsConnection);
 }
 
 //***********************************************************************
-uint16_t ICACHE_FLASH_ATTR countWsConnections( void ) {
-    uint16_t count = 0;
-    for (int slotId = 0; slotId < WS_MAXCONN; slotId++) {
-        WSConnection connection = wsConnections[slotId];
-        if (connection.connection != NULL && connection.status == STATUS_OPEN) {
-            count++;
+// Incremental frame parser.  Complete, unfragmented frames that lie entirely
+// within the segment are unmasked and dispatched in place.  Anything else is
+// collected where it will be used - control frames in rxControl, message
+// fragments and split frames appended to the message in rxBuffer - and
+// unmasked there as the bytes arrive.
+static void ICACHE_FLASH_ATTR feedWsFrames(WSConnection *wsConnection, char *data, uint32_t len) {
+  WSFrame *frame = &wsConnection->rxFrame;
+
+  while (len > 0 && wsConnection->status == STATUS_OPEN) {
+    if (wsConnection->rxState == RX_STATE_HEADER) {
+#if WS_METRICS
+      uint32_t parseStart = WS_CYCLE_COUNT();
+#endif
+      if (wsConnection->rxHeaderLength == 0 && len >= 2 && len >= wsframe_headerLength((uint8_t *)data)) {
+        //the whole header is in this segment
+        uint8_t headerLength = wsframe_decodeHeader((uint8_t *)data, frame);
+        data += headerLength;
+        len -= headerLength;
+      } else {
+        //collect the header piece by piece
+        uint8_t headerLength = (wsConnection->rxHeaderLength < 2) ? 2 : wsframe_headerLength(wsConnection->rxHeader);
+        while (len > 0 && wsConnection->rxHeaderLength < headerLength) {
+          wsConnection->rxHeader[wsConnection->rxHeaderLength++] = *data++;
+          len--;
+          if (wsConnection->rxHeaderLength == 2) {
+            headerLength = wsframe_headerLength(wsConnection->rxHeader);
+          }
         }
+        if (wsConnection->rxHeaderLength < headerLength) {
+          return; //wait for the rest of the header
+        }
+        wsframe_decodeHeader(wsConnection->rxHeader, frame);
+        wsConnection->rxHeaderLength = 0;
+      }
+
+      if (!acceptWsFrame(wsConnection)) {
+        return;
+      }
+#if WS_METRICS
+      wsConnection->metrics.parseCycles += WS_CYCLE_COUNT() - parseStart;
+      countWsFrame(wsConnection->metrics.framesIn, wsConnection->metrics.bytesIn, frame->opcode, frame->payloadLength);
+#endif
+
+      bool fragment = frame->opcode == OPCODE_CONTINUE || !(frame->flags & FLAG_FIN);
+      if (!fragment && frame->payloadLength <= len) {
+        //an entire frame, no need to copy anything
+        uint32_t payloadLength = frame->payloadLength;
+#if WS_METRICS
+        uint32_t unmaskStart = WS_CYCLE_COUNT();
+        unmaskWsPayload(data, payloadLength, frame->maskingKey, 0);
+        wsConnection->metrics.unmaskCycles += WS_CYCLE_COUNT() - unmaskStart;
+#else
+        unmaskWsPayload(data, payloadLength, frame->maskingKey, 0);
+#endif
+        frame->payloadData = data;
+        data += payloadLength;
+        len -= payloadLength;
+        completeWsFrame(wsConnection, frame, data - 1);
+        continue;
+      }
+
+      if (frame->opcode & OPCODE_CONTROL) {
+        frame->payloadData = wsConnection->rxControl;
+      } else {
+        frame->payloadData = wsConnection->rxBuffer + wsConnection->rxMessageLength;
+      }
+      wsConnection->rxPayloadReceived = 0;
+      wsConnection->rxKeyOffset = 0;
+      wsConnection->rxState = RX_STATE_PAYLOAD;
     }
-    return count;
+
+    uint32_t remaining = frame->payloadLength - wsConnection->rxPayloadReceived;
+    uint32_t chunk = (len < remaining) ? len : remaining;
+    char *chunkStart = frame->payloadData + wsConnection->rxPayloadReceived;
+
+    os_memcpy(chunkStart, data, chunk);
+#if WS_METRICS
+    uint32_t unmaskStart = WS_CYCLE_COUNT();
+    wsConnection->rxKeyOffset = unmaskWsPayload(chunkStart, chunk, frame->maskingKey, wsConnection->rxKeyOffset);
+    wsConnection->metrics.unmaskCycles += WS_CYCLE_COUNT() - unmaskStart;
+#else
+    wsConnection->rxKeyOffset = unmaskWsPayload(chunkStart, chunk, frame->maskingKey, wsConnection->rxKeyOffset);
+#endif
+    wsConnection->rxPayloadReceived += chunk;
+    data += chunk;
+    len -= chunk;
+
+    if (wsConnection->rxPayloadReceived == frame->payloadLength) {
+      wsConnection->rxState = RX_STATE_HEADER;
+      completeWsFrame(wsConnection, frame, NULL);
+    }
+  }
 }
 
 //***********************************************************************
-void ICACHE_FLASH_ATTR sendWsMessage(WSConnection *connection,
-                                     const char *payload,
-                                     uint32_t payloadLength,
-                                     uint8_t options) {
-  //  webSocketDebug("sendWsMessage-->%s<-- payloadLength=%d\n", payload,payloadLength);
-
-  uint8_t payloadLengthField[9];
-  uint8_t payloadLengthFieldLength = 0;
-
-  if (payloadLength > ((1 << 16) - 1)) {
-    payloadLengthField[0] = 127;
-    os_memcpy(payloadLengthField + 1, &payloadLength, sizeof(uint32_t));
-    payloadLengthFieldLength = sizeof(uint32_t) + 1;
-  } else if (payloadLength > ((1 << 8) - 1)) {
-    payloadLengthField[0] = 126;
-    os_memcpy(payloadLengthField + 1, &payloadLength, sizeof(uint16_t));
-    payloadLengthFieldLength = sizeof(uint16_t) + 1;
-  } else {
-    payloadLengthField[0] = payloadLength;
-    payloadLengthFieldLength = 1;
+// Checks a freshly parsed frame header against RFC 6455 and the message size
+// limit, closing the connection if the frame can't be accepted.  The first
+// fragment of a message records the message's opcode.
+static bool ICACHE_FLASH_ATTR acceptWsFrame(WSConnection *wsConnection) {
+  WSFrame *frame = &wsConnection->rxFrame;
+
+  if ((frame->isMasked != 0) == wsConnection->server->isClient) {
+    //clients must mask their frames and servers must not (RFC 6455 section
+    //5.1), the connection is shut down otherwise
+    closeWsConnection(wsConnection);
+    return false;
+  }
+
+  if (frame->flags & (FLAG_RSV2 | FLAG_RSV3)) {
+    //no extension we know of uses these
+    closeWsConnection(wsConnection);
+    return false;
+  }
+
+  if ((frame->flags & FLAG_RSV1) &&
+      (wsConnection->deflateWindowBits == 0 || (frame->opcode & OPCODE_CONTROL) || frame->opcode == OPCODE_CONTINUE)) {
+    //RSV1 marks a compressed message (RFC 7692 section 6), set on its first frame only
+    closeWsConnection(wsConnection);
+    return false;
+  }
+
+  if (frame->opcode & OPCODE_CONTROL) {
+    //control frames may be interleaved with fragments, but can't be fragmented themselves
+    if (!(frame->flags & FLAG_FIN) || frame->payloadLength > WS_MAX_CONTROL_PAYLOAD) {
+      closeWsConnection(wsConnection);
+      return false;
+    }
+    return true;
   }
 
-  uint64_t maximumPossibleMessageSize = 14 + payloadLength; //14 bytes is the biggest frame header size
-  char message[maximumPossibleMessageSize];
-  message[0] = FLAG_FIN | options;
+  if (frame->opcode == OPCODE_CONTINUE) {
+    if (wsConnection->rxMessageOpcode == OPCODE_CONTINUE) {
+      //nothing to continue
+      closeWsConnection(wsConnection);
+      return false;
+    }
+  } else {
+    if (wsConnection->rxMessageOpcode != OPCODE_CONTINUE) {
+      //a new message before the previous one was finished
+      closeWsConnection(wsConnection);
+      return false;
+    }
+    if (!(frame->flags & FLAG_FIN)) {
+      wsConnection->rxMessageOpcode = frame->opcode;
+      wsConnection->rxMessageCompressed = (frame->flags & FLAG_RSV1) != 0;
+    }
+  }
 
-  os_memcpy(message + 1, &payloadLengthField, payloadLengthFieldLength);
-  os_memcpy(message + 1 + payloadLengthFieldLength, payload, strlen(payload));
+  if (wsConnection->rxMessageLength + frame->payloadLength > wsConnection->server->rxBufferSize) {
+    wsLogWarn("webSocket message of more than %d bytes\n", wsConnection->server->rxBufferSize);
+    closeWsConnection(wsConnection);
+    return false;
+  }
 
-  espconn_sent(connection->connection, (uint8_t *)&message, payloadLength + 1 + payloadLengthFieldLength);
+  return true;
 }
 
 //***********************************************************************
-void ICACHE_FLASH_ATTR webSocketSentCb(void *arg) {
-  //data sent successfully
-  //webSocketDebug("webSocket sent cb \r\n");
-  struct espconn *requestconn = (espconn *)arg;
-  //  espconn_disconnect( requestconn );
+// Called once a frame's payload has been received and unmasked.  Control
+// frames and unfragmented messages are handled straight away; fragments are
+// added to the message being assembled in rxBuffer, which is handled as one
+// message once its final fragment is in.
+static void ICACHE_FLASH_ATTR completeWsFrame(WSConnection *wsConnection, WSFrame *frame, char *lastByte) {
+  if ((frame->opcode & OPCODE_CONTROL) || (frame->opcode != OPCODE_CONTINUE && (frame->flags & FLAG_FIN))) {
+    handleWsFrame(wsConnection, frame, lastByte);
+    return;
+  }
+
+  wsConnection->rxMessageLength += frame->payloadLength;
+  if (frame->flags & FLAG_FIN) {
+    frame->opcode = wsConnection->rxMessageOpcode;
+    if (wsConnection->rxMessageCompressed) {
+      frame->flags |= FLAG_RSV1;
+    }
+    frame->payloadData = wsConnection->rxBuffer;
+    frame->payloadLength = wsConnection->rxMessageLength;
+    wsConnection->rxMessageOpcode = OPCODE_CONTINUE;
+    wsConnection->rxMessageLength = 0;
+    handleWsFrame(wsConnection, frame, NULL);
+  }
 }
 
-/***********************************************************************/
-void ICACHE_FLASH_ATTR webSocketDisconCb(void *arg) {
-  espconn *esp_connection = (espconn*)arg;
+//***********************************************************************
+// Acts on one complete, unmasked frame or message.  lastByte points at the
+// last byte of an in place payload within the receive segment, or is NULL
+// when the payload sits in the connection's rxBuffer or rxControl.
+static void ICACHE_FLASH_ATTR handleWsFrame(WSConnection *wsConnection, WSFrame *frame, char *lastByte) {
+  if (frame->opcode == OPCODE_PING) {
+    sendWsMessage(wsConnection, frame->payloadData, frame->payloadLength, FLAG_FIN | OPCODE_PONG);
+    return;
+  }
 
-  WSConnection *wsConn = getWsConnection( esp_connection);
-  if ( wsConn != NULL ) {
-    wsConn->status = STATUS_CLOSED;
-    webSocketDebug("Leaving webSocket_server_discon_cb found\n");
+  if (frame->opcode == OPCODE_CLOSE) {
+    //gracefully shut down the connection
+    closeWsConnection(wsConnection);
     return;
   }
 
-  webSocketDebug("Leaving webSocket_server_discon_cb  didn't find\n");
-  return;
+  if (frame->opcode == OPCODE_PONG) {
+    takeWsPong(wsConnection, frame);
+    return;
+  }
+
+#if WS_DEFLATE
+  if (frame->flags & FLAG_RSV1) {
+    WSServer *server = wsConnection->server;
+    int32_t length = wsdeflate_inflate((const uint8_t *)frame->payloadData, frame->payloadLength,
+                                       (uint8_t *)server->inflateBuffer, server->rxBufferSize);
+    if (length < 0) {
+      wsLogWarn("webSocket bad compressed message, or more than %d bytes\n", server->rxBufferSize);
+      closeWsConnection(wsConnection);
+      return;
+    }
+    frame->payloadData = server->inflateBuffer;
+    frame->payloadLength = length;
+    lastByte = NULL;
+  }
+#endif
+
+  if (frame->opcode == OPCODE_TEXT && wsConnection->server->subscriptionMessages &&
+      wsConnection->server->topicCount != 0 && takeWsSubscription(wsConnection, frame)) {
+    return;
+  }
+
+  if (wsConnection->onView != NULL) {
+    WSView view;
+    view.connection = wsConnection;
+    view.opcode = frame->opcode;
+    view.data = frame->payloadData;
+    view.length = frame->payloadLength;
+    wsConnection->onView(&view, wsConnection->viewContext);
+  }
+
+  if (wsConnection->onData != NULL) {
+    wsConnection->onData(wsConnection, frame->opcode, frame->payloadData, frame->payloadLength, wsConnection->userContext);
+  }
+
+  if (wsConnection->onMessage != NULL) {
+    //onMessage expects a NUL terminated string.  rxBuffer has room for the
+    //terminator; an in place payload is moved down one byte over its (already
+    //parsed) header so the terminator doesn't clobber the next frame
+    if (lastByte == NULL) {
+      frame->payloadData[frame->payloadLength] = '\0';
+    } else {
+      os_memmove(frame->payloadData - 1, frame->payloadData, frame->payloadLength);
+      frame->payloadData--;
+      *lastByte = '\0';
+    }
+    wsConnection->onMessage(frame->payloadData);
+  }
 }
 
-/***********************************************************************/
-void ICACHE_FLASH_ATTR webSocketReconCb(void *arg, sint8 err) {
-  webSocketDebug("In webSocket_server_recon_cb err=%d\n", err );
+//***********************************************************************
+// Acts on a subscribe or unsubscribe message, returning false for any other
+// message.  Requests for topics the server doesn't have are ignored.
+static bool ICACHE_FLASH_ATTR takeWsSubscription(WSConnection *wsConnection, WSFrame *frame) {
+  const uint8_t subscribeLength = sizeof(WS_SUBSCRIBE) - 1;
+  const uint8_t unsubscribeLength = sizeof(WS_UNSUBSCRIBE) - 1;
+  bool subscribe;
+  uint8_t prefixLength;
+
+  if (frame->payloadLength >= subscribeLength && os_memcmp(frame->payloadData, WS_SUBSCRIBE, subscribeLength) == 0) {
+    subscribe = true;
+    prefixLength = subscribeLength;
+  } else if (frame->payloadLength >= unsubscribeLength &&
+             os_memcmp(frame->payloadData, WS_UNSUBSCRIBE, unsubscribeLength) == 0) {
+    subscribe = false;
+    prefixLength = unsubscribeLength;
+  } else {
+    return false;
+  }
+
+  uint32_t nameLength = frame->payloadLength - prefixLength;
+  int8_t topic = (nameLength <= 0xFF) ? findWsTopic(wsConnection->server, frame->payloadData + prefixLength, nameLength)
+                                      : WS_NO_TOPIC;
+  if (topic == WS_NO_TOPIC) {
+    wsLogDebug("webSocket no topic %.*s\n", (int)nameLength, frame->payloadData + prefixLength);
+  } else if (subscribe) {
+    subscribeWsTopic(wsConnection, topic);
+  } else {
+    unsubscribeWsTopic(wsConnection, topic);
+  }
+  return true;
+}
+
+//***********************************************************************
+// Only the answer to our latest ping counts, unsolicited pongs and late
+// answers are ignored.
+static void ICACHE_FLASH_ATTR takeWsPong(WSConnection *wsConnection, WSFrame *frame) {
+  uint32_t sentAt;
+
+  if (wsConnection->pingsUnanswered == 0 || frame->payloadLength != sizeof(sentAt)) {
+    return;
+  }
+  os_memcpy(&sentAt, frame->payloadData, sizeof(sentAt));
+  if (sentAt == wsConnection->pingSentAt) {
+    wsConnection->roundTripTime = system_get_time() - sentAt;
+    wsConnection->pingsUnanswered = 0;
+  }
+}
+
+//***********************************************************************
+// Unmask a payload in place (IEEE RFC 6455 Section 5.3).  keyOffset is the
+// position within the 4-byte masking key of the first payload byte, so a
+// payload can be unmasked in several pieces.  Returns the key offset for the
+// byte following the payload.  XOR being its own inverse, a client masks its
+// outgoing frames with the same routine.
+//
+// The bulk of the payload is XORed a machine word at a time: the unaligned
+// head is done byte wise, after which the key is rotated so that it lines up
+// with the aligned words, and the tail is finished byte wise again.
+static uint8_t ICACHE_FLASH_ATTR unmaskWsPayload(char *maskedPayload,
+                                                 uint32_t payloadLength,
+                                                 uint32_t maskingKey,
+                                                 uint8_t keyOffset) {
+  const uint8_t *key = (const uint8_t *)&maskingKey;
+  uint8_t *data = (uint8_t *)maskedPayload;
+  uint8_t *end = data + payloadLength;
+
+  keyOffset &= 3;
+
+  if (maskingKey == 0) {
+    //nothing to do, a server's frames to a client aren't masked at all
+    return (keyOffset + payloadLength) & 3;
+  }
+
+  //unaligned head
+  while (data < end && ((uintptr_t)data & (sizeof(WSMaskWord) - 1)) != 0) {
+    *data++ ^= key[keyOffset];
+    keyOffset = (keyOffset + 1) & 3;
+  }
+
+  if ((uint32_t)(end - data) >= sizeof(WSMaskWord)) {
+    //lay the key out in memory order starting at keyOffset, repeated to fill a word
+    uint8_t rotatedKey[sizeof(WSMaskWord)];
+    for (uint8_t i = 0; i < sizeof(WSMaskWord); i++) {
+      rotatedKey[i] = key[(keyOffset + i) & 3];
+    }
+    WSMaskWord keyWord;
+    os_memcpy(&keyWord, rotatedKey, sizeof(WSMaskWord));
+
+    WSMaskWord *word = (WSMaskWord *)data;
+    WSMaskWord *lastWord = (WSMaskWord *)(end - ((uintptr_t)end & (sizeof(WSMaskWord) - 1)));
+    while (word < lastWord) {
+      *word++ ^= keyWord;
+    }
+    //a whole number of words keeps keyOffset unchanged
+    data = (uint8_t *)word;
+  }
+
+  //tail
+  while (data < end) {
+    *data++ ^= key[keyOffset];
+    keyOffset = (keyOffset + 1) & 3;
+  }
+
+  return keyOffset;
+}
+
+//***********************************************************************
+// Each accepted espconn carries its slot in the reverse pointer, so the
+// lookup normally costs nothing.  The SDK hands some callbacks (notably the
+// disconnect callback) a different espconn for the same peer; for those we
+// fall back to matching remote ip and port, which were copied into the
+// slot when the connection was accepted.
+WSConnection *ICACHE_FLASH_ATTR getWsConnection(struct espconn *connection) {
+  WSConnection *wsConnection = (WSConnection *)connection->reverse;
+  WSServer *server;
+
+  for (server = wsServers; server != NULL; server = server->next) {
+    if (wsConnection >= server->connections && wsConnection < server->connections + server->maxConnections) {
+      if (wsConnection->connection == connection) {
+        return wsConnection;
+      }
+      break;
+    }
+  }
+
+  for (server = wsServers; server != NULL; server = server->next) {
+    for (int slotId = 0; slotId < server->maxConnections; slotId++) {
+      wsConnection = &server->connections[slotId];
+      if (wsConnection->connection != NULL &&
+          wsConnection->remotePort == connection->proto.tcp->remote_port &&
+          os_memcmp(wsConnection->remoteIp, connection->proto.tcp->remote_ip, sizeof(wsConnection->remoteIp)) == 0) {
+        return wsConnection;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+//***********************************************************************
+// The accept key is base64(sha1(key + WS_GUID)).  The key is always
+// WS_KEY_LENGTH (24) characters, so the 60 byte message and its padding are
+// laid out directly as two SHA-1 blocks: the key words, the GUID words
+// (constant, precomputed below) and the 0x80 terminator fill the first, the
+// second holds only the bit length.  The 20 byte hash always encodes to 28
+// base64 characters.
+static const uint32_t wsGuidWords[9] = {
+  0x32353845, 0x41464135, 0x2d453931, 0x342d3437, 0x44412d39,
+  0x3543412d, 0x43354142, 0x30444338, 0x35423131
+};
+
+static int ICACHE_FLASH_ATTR createWsAcceptKey(const char *key, char *buffer, int bufferSize) {
+  sha1nfo s;
+  uint8_t hash[HASH_LENGTH];
+  const uint8_t *k = (const uint8_t *)key;
+  uint8_t i;
+
+  if (bufferSize < 29) {
+    return -1;
+  }
+
+  sha1_init(&s);
+
+  for (i = 0; i < 6; i++, k += 4) {
+    s.buffer[i] = ((uint32_t)k[0] << 24) | ((uint32_t)k[1] << 16) | ((uint32_t)k[2] << 8) | k[3];
+  }
+  os_memcpy(&s.buffer[6], wsGuidWords, sizeof(wsGuidWords));
+  s.buffer[15] = 0x80000000;
+  sha1_hashBlock(&s);
+
+  os_memset(s.buffer, 0, sizeof(s.buffer));
+  s.buffer[15] = (WS_KEY_LENGTH + sizeof(wsGuidWords)) * 8;
+  sha1_hashBlock(&s);
+
+  for (i = 0; i < 5; i++) {
+    hash[4 * i] = s.state[i] >> 24;
+    hash[4 * i + 1] = s.state[i] >> 16;
+    hash[4 * i + 2] = s.state[i] >> 8;
+    hash[4 * i + 3] = s.state[i];
+  }
+
+  base64_encode20(hash, buffer);
+  return 28;
+}
+
+//***********************************************************************
+// Microseconds between the latest answered keepalive ping and its pong, or
+// 0 if none has been answered yet.
+uint32_t ICACHE_FLASH_ATTR getWsRoundTripTime(WSConnection *connection) {
+  return connection->roundTripTime;
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR closeWsConnection(WSConnection * connection) {
+  //a close frame from the server is unmasked and, here, has no payload
+  sendWsMessage(connection, NULL, 0, OPCODE_CLOSE);
+  connection->status = STATUS_CLOSED;
+  //in case the close frame never gets out
+  scheduleWsTimer(connection, WS_CLOSE_TIMEOUT);
+  return;
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR broadcastWsServer(WSServer *server, const char *payload, uint32_t payloadLength, uint8_t options) {
+    sendWsToSubscribers(server, NULL, payload, payloadLength, options);
+}
+
+//***********************************************************************
+// The frame is encoded once and the same buffer is queued on every open
+// connection whose slot is in subscribers (all of them if it is NULL), each
+// queue holding a reference
+// to it.  Connections using permessage-deflate share a second, compressed,
+// encoding made with the smallest window any of them allows.
+static void ICACHE_FLASH_ATTR sendWsToSubscribers(WSServer *server,
+                                                  const uint32_t *subscribers,
+                                                  const char *payload,
+                                                  uint32_t payloadLength,
+                                                  uint8_t options) {
+    WSTxBuffer *plain = NULL;
+    WSTxBuffer *deflated = NULL;
+    uint8_t windowBits = 0;
+
+    for (int slotId = 0; slotId < server->maxConnections; slotId++) {
+        WSConnection *connection = &server->connections[slotId];
+        if ((subscribers == NULL || (subscribers[slotId >> 5] & (1UL << (slotId & 31)))) && connection->connection != NULL &&
+            connection->status == STATUS_OPEN && connection->deflateWindowBits != 0 &&
+            (windowBits == 0 || connection->deflateWindowBits < windowBits)) {
+            windowBits = connection->deflateWindowBits;
+        }
+    }
+
+    for (int slotId = 0; slotId < server->maxConnections; slotId++) {
+        WSConnection *connection = &server->connections[slotId];
+        if ((subscribers == NULL || (subscribers[slotId >> 5] & (1UL << (slotId & 31)))) && connection->connection != NULL &&
+            connection->status == STATUS_OPEN) {
+            WSTxBuffer **buffer = (connection->deflateWindowBits != 0) ? &deflated : &plain;
+            if (*buffer == NULL) {
+                *buffer = buildWsFrame(payload, payloadLength, options, (buffer == &deflated) ? windowBits : 0, server->isClient);
+                if (*buffer == NULL) {
+                    break;
+                }
+            }
+            (*buffer)->refCount++;
+#if WS_METRICS
+            if (queueWsTxBuffer(connection, *buffer) == WS_OK && connection->connection != NULL) {
+                countWsFrame(connection->metrics.framesOut, connection->metrics.bytesOut, options, payloadLength);
+            }
+#else
+            queueWsTxBuffer(connection, *buffer);
+#endif
+        }
+    }
+
+    if (plain != NULL) {
+        releaseWsTxBuffer(plain);
+    }
+    if (deflated != NULL) {
+        releaseWsTxBuffer(deflated);
+    }
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR broadcastWsMessage(const char *payload, uint32_t payloadLength, uint8_t options) {
+    broadcastWsServer(&defaultWsServer(), payload, payloadLength, options);
+}
+
+//***********************************************************************
+uint16_t ICACHE_FLASH_ATTR countWsServerConnections(WSServer *server) {
+    uint16_t count = 0;
+    for (int slotId = 0; slotId < server->maxConnections; slotId++) {
+        WSConnection *connection = &server->connections[slotId];
+        if (connection->connection != NULL && connection->status == STATUS_OPEN) {
+            count++;
+        }
+    }
+    return count;
+}
+
+//***********************************************************************
+uint16_t ICACHE_FLASH_ATTR countWsConnections( void ) {
+    return countWsServerConnections(&defaultWsServer());
+}
+
+//***********************************************************************
+// Adds a topic clients can subscribe to, or finds it if it already exists.
+// Returns its number, or WS_NO_TOPIC if the server has WS_MAX_TOPICS, or
+// no subscriber storage (a client).
+int8_t ICACHE_FLASH_ATTR addWsTopic(WSServer *server, const char *name) {
+  uint32_t length = os_strlen(name);
+  if (length > 0xFF) {
+    return WS_NO_TOPIC;
+  }
+  uint8_t nameLength = length;
+  int8_t topic = findWsTopic(server, name, nameLength);
+  if (topic != WS_NO_TOPIC || server->topicCount == WS_MAX_TOPICS || server->subscriberWords == 0) {
+    return topic;
+  }
+
+  topic = server->topicCount++;
+  server->topics[topic].name = name;
+  server->topics[topic].nameLength = nameLength;
+  os_memset(server->topics[topic].subscribers, 0, server->subscriberWords * sizeof(uint32_t));
+
+  uint8_t slot = hashWsTopic(name, nameLength);
+  while (server->topicIndex[slot] != 0) {
+    slot = (slot + 1) & (WS_TOPIC_HASH_SLOTS - 1);
+  }
+  server->topicIndex[slot] = topic + 1;
+  return topic;
+}
+
+//***********************************************************************
+// The hash table is never more than half full, so a lookup normally takes
+// one or two probes.
+int8_t ICACHE_FLASH_ATTR findWsTopic(WSServer *server, const char *name, uint8_t nameLength) {
+  uint8_t slot = hashWsTopic(name, nameLength);
+
+  while (server->topicIndex[slot] != 0) {
+    WSTopic *topic = &server->topics[server->topicIndex[slot] - 1];
+    if (topic->nameLength == nameLength && os_memcmp(topic->name, name, nameLength) == 0) {
+      return server->topicIndex[slot] - 1;
+    }
+    slot = (slot + 1) & (WS_TOPIC_HASH_SLOTS - 1);
+  }
+  return WS_NO_TOPIC;
+}
+
+//***********************************************************************
+// FNV-1a, folded down to a hash table slot.
+static uint8_t ICACHE_FLASH_ATTR hashWsTopic(const char *name, uint8_t nameLength) {
+  uint32_t hash = 2166136261u;
+  for (uint8_t i = 0; i < nameLength; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return (hash ^ (hash >> 16)) & (WS_TOPIC_HASH_SLOTS - 1);
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR subscribeWsTopic(WSConnection *connection, int8_t topic) {
+  WSServer *server = connection->server;
+  if (topic >= 0 && topic < server->topicCount) {
+    uint8_t slotId = connection - server->connections;
+    server->topics[topic].subscribers[slotId >> 5] |= 1UL << (slotId & 31);
+  }
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR unsubscribeWsTopic(WSConnection *connection, int8_t topic) {
+  WSServer *server = connection->server;
+  if (topic >= 0 && topic < server->topicCount) {
+    uint8_t slotId = connection - server->connections;
+    server->topics[topic].subscribers[slotId >> 5] &= ~(1UL << (slotId & 31));
+  }
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR publishWsTopic(WSServer *server, int8_t topic, const char *payload, uint32_t payloadLength, uint8_t options) {
+  if (topic >= 0 && topic < server->topicCount) {
+    sendWsToSubscribers(server, server->topics[topic].subscribers, payload, payloadLength, options);
+  }
+}
+
+//***********************************************************************
+int8_t ICACHE_FLASH_ATTR webSocketAddTopic( const char *name ) {
+  return addWsTopic(&defaultWsServer(), name);
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR publishWsMessage(int8_t topic, const char *payload, uint32_t payloadLength, uint8_t options) {
+  publishWsTopic(&defaultWsServer(), topic, payload, payloadLength, options);
+}
+
+//***********************************************************************
+sint8 ICACHE_FLASH_ATTR sendWsMessage(WSConnection *connection,
+                                     const char *payload,
+                                     uint32_t payloadLength,
+                                     uint8_t options) {
+  if (connection->txCount == connection->server->txQueueDepth) {
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  WSTxBuffer *buffer = buildWsFrame(payload, payloadLength, options, connection->deflateWindowBits,
+                                    connection->server->isClient);
+  if (buffer == NULL) {
+    return WS_ERR_MEM;
+  }
+
+  sint8 ret = queueWsTxBuffer(connection, buffer);
+#if WS_METRICS
+  //not counted if the send broke the connection, whose metrics are gone
+  if (ret == WS_OK && connection->connection != NULL) {
+    countWsFrame(connection->metrics.framesOut, connection->metrics.bytesOut, options, payloadLength);
+  }
+#endif
+  return ret;
+}
+
+//***********************************************************************
+// Sends a message without copying the payload.  Only the frame header is
+// built, in a small buffer of its own; the payload is handed to the SDK
+// straight from the caller's buffer, in chunks of up to WS_TX_MSS bytes.
+// The payload must therefore stay untouched until onSent(payload, context)
+// is called, which happens exactly once if, and only if, WS_OK is returned.
+// These messages are never compressed.  A client has to mask the payload,
+// so it sends a copy and hands the payload back straight away.
+sint8 ICACHE_FLASH_ATTR sendWsMessageNoCopy(WSConnection *connection,
+                                           const char *payload,
+                                           uint32_t payloadLength,
+                                           uint8_t options,
+                                           WSOnSent onSent,
+                                           void *context) {
+  if (connection->server->isClient) {
+    sint8 ret = sendWsMessage(connection, payload, payloadLength, options);
+    if (ret == WS_OK) {
+      onSent(payload, context);
+    }
+    return ret;
+  }
+
+  if (connection->txCount + 2 > connection->server->txQueueDepth) {
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  uint8_t header[WS_MAX_HEADER_LENGTH];
+  uint8_t headerLength = wsframe_encodeHeader(header, FLAG_FIN | options, payloadLength, NULL);
+
+  WSTxBuffer *headerBuffer = allocWsTxBuffer(headerLength);
+  WSTxBuffer *payloadBuffer = allocWsTxBuffer(0);
+  if (headerBuffer == NULL || payloadBuffer == NULL) {
+    if (headerBuffer != NULL) {
+      freeWsBlock(headerBuffer);
+    }
+    if (payloadBuffer != NULL) {
+      freeWsBlock(payloadBuffer);
+    }
+    return WS_ERR_MEM;
+  }
+  os_memcpy(headerBuffer->data, header, headerLength);
+
+  payloadBuffer->length = payloadLength;
+  payloadBuffer->data = (uint8_t *)payload;
+  payloadBuffer->onSent = onSent;
+  payloadBuffer->sentContext = context;
+
+  queueWsTxBuffer(connection, headerBuffer);
+  if (connection->connection == NULL) {
+    //the connection broke on the header: the payload was never lent
+    freeWsBlock(payloadBuffer);
+    return WS_ERR_CLOSED;
+  }
+  sint8 ret = queueWsTxBuffer(connection, payloadBuffer);
+#if WS_METRICS
+  if (ret == WS_OK && connection->connection != NULL) {
+    countWsFrame(connection->metrics.framesOut, connection->metrics.bytesOut, options, payloadLength);
+  }
+#endif
+  return ret;
+}
+
+//***********************************************************************
+// Starts a batch: small frames appended to it are encoded back to back in
+// one WS_TX_MSS buffer, and go out in a single espconn_sent (and normally a
+// single tcp segment) when it is flushed.  Frames in a batch are never
+// compressed.
+sint8 ICACHE_FLASH_ATTR beginWsBatch(WSBatch *batch, WSConnection *connection) {
+  batch->connection = connection;
+  batch->buffer = NULL;
+  if (connection->txCount == connection->server->txQueueDepth) {
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  batch->buffer = allocWsTxBuffer(WS_TX_MSS);
+  if (batch->buffer == NULL) {
+    return WS_ERR_MEM;
+  }
+  batch->buffer->length = 0;
+#if WS_METRICS
+  os_memset(batch->framesOut, 0, sizeof(batch->framesOut));
+  os_memset(batch->bytesOut, 0, sizeof(batch->bytesOut));
+#endif
+  return WS_OK;
+}
+
+//***********************************************************************
+// Adds a frame to the batch.  Returns WS_ERR_WOULD_BLOCK, leaving the batch
+// as it was, when the frame doesn't fit in what is left of it; the caller
+// then flushes and begins another, or sends the frame on its own.
+sint8 ICACHE_FLASH_ATTR appendWsBatch(WSBatch *batch, const char *payload, uint32_t payloadLength, uint8_t options) {
+  WSTxBuffer *buffer = batch->buffer;
+  bool mask = batch->connection->server->isClient;
+
+  if (buffer == NULL) {
+    return WS_ERR_MEM;
+  }
+  if (payloadLength > WS_TX_MSS ||
+      buffer->length + wsFrameHeaderLength(payloadLength, mask) + payloadLength > WS_TX_MSS) {
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  buffer->length += encodeWsFrame(buffer->data + buffer->length, payload, payloadLength, options, mask);
+#if WS_METRICS
+  countWsFrame(batch->framesOut, batch->bytesOut, options, payloadLength);
+#endif
+  return WS_OK;
+}
+
+//***********************************************************************
+// Queues the batch's frames as one transmit buffer.  An empty batch is
+// just dropped, and so is a batch the queue has no room for, returning
+// WS_ERR_WOULD_BLOCK: its frames are lost and aren't counted as sent.
+// Either way the batch is finished, and must be begun again before it is
+// reused.
+sint8 ICACHE_FLASH_ATTR flushWsBatch(WSBatch *batch) {
+  WSTxBuffer *buffer = batch->buffer;
+  batch->buffer = NULL;
+
+  if (buffer == NULL) {
+    return WS_ERR_MEM;
+  }
+  if (buffer->length == 0) {
+    releaseWsTxBuffer(buffer);
+    return WS_OK;
+  }
+
+  sint8 ret = queueWsTxBuffer(batch->connection, buffer);
+#if WS_METRICS
+  if (ret == WS_OK && batch->connection->connection != NULL) {
+    WSMetrics *metrics = &batch->connection->metrics;
+    for (uint8_t i = 0; i < WS_METRICS_OPCODES; i++) {
+      metrics->framesOut[i] += batch->framesOut[i];
+      metrics->bytesOut[i] += batch->bytesOut[i];
+    }
+  }
+#endif
+  return ret;
+}
+
+//***********************************************************************
+// Throws the batch away unsent, giving its buffer back.  Like a flush it
+// finishes the batch, and a batch that is already finished is left alone.
+void ICACHE_FLASH_ATTR abortWsBatch(WSBatch *batch) {
+  if (batch->buffer != NULL) {
+    releaseWsTxBuffer(batch->buffer);
+    batch->buffer = NULL;
+  }
+}
+
+//***********************************************************************
+// Sends a message that only matters until a newer one with the same key
+// (1-255) comes along, such as a sensor reading.  If a message with this
+// key is still waiting in the queue it is replaced, in its place, so a slow
+// client gets the latest value next instead of working through a backlog,
+// and each key holds at most one queue entry.  A message already being sent
+// isn't touched.
+sint8 ICACHE_FLASH_ATTR sendWsLatest(WSConnection *connection,
+                                    uint8_t key,
+                                    const char *payload,
+                                    uint32_t payloadLength,
+                                    uint8_t options) {
+  int16_t slot = findWsLatest(connection, key);
+  if (slot < 0 && connection->txCount == connection->server->txQueueDepth) {
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  WSTxBuffer *buffer = buildWsFrame(payload, payloadLength, options, connection->deflateWindowBits,
+                                    connection->server->isClient);
+  if (buffer == NULL) {
+    return WS_ERR_MEM;
+  }
+  buffer->latestKey = key;
+
+  if (slot < 0) {
+    sint8 ret = queueWsTxBuffer(connection, buffer);
+#if WS_METRICS
+    if (ret == WS_OK && connection->connection != NULL) {
+      countWsFrame(connection->metrics.framesOut, connection->metrics.bytesOut, options, payloadLength);
+    }
+#endif
+    return ret;
+  }
+
+#if WS_METRICS
+  countWsFrame(connection->metrics.framesOut, connection->metrics.bytesOut, options, payloadLength);
+  connection->metrics.superseded++;
+#endif
+  releaseWsTxBuffer(connection->txQueue[slot]);
+  connection->txQueue[slot] = buffer;
+  return WS_OK;
+}
+
+//***********************************************************************
+// The queue entry holding the sendWsLatest message with this key, or -1.
+static int16_t ICACHE_FLASH_ATTR findWsLatest(WSConnection *connection, uint8_t key) {
+  uint8_t slot = connection->txHead;
+
+  if (key == 0) {
+    return -1;
+  }
+  for (uint8_t n = 0; n < connection->txCount; n++) {
+    if (connection->txQueue[slot]->latestKey == key) {
+      return slot;
+    }
+    slot = nextWsTxSlot(connection, slot);
+  }
+  return -1;
+}
+
+//***********************************************************************
+// Encodes a complete frame into a new transmit buffer, compressed if
+// deflateWindowBits is set and the message is worth it.  A client's frames
+// are masked with a fresh random key, by the same word wise XOR that
+// unmasks what we receive.
+static WSTxBuffer *ICACHE_FLASH_ATTR buildWsFrame(const char *payload, uint32_t payloadLength, uint8_t options, uint8_t deflateWindowBits, bool mask) {
+#if WS_DEFLATE
+  if (deflateWindowBits != 0 && !(options & OPCODE_CONTROL) &&
+      payloadLength >= WS_DEFLATE_MIN_SIZE && payloadLength <= WSDEFLATE_MAX_INPUT) {
+    WSTxBuffer *buffer = deflateWsFrame(payload, payloadLength, options, deflateWindowBits);
+    if (buffer != NULL) {
+      return buffer;
+    }
+  }
+#else
+  (void)deflateWindowBits;
+#endif
+
+  WSTxBuffer *buffer = allocWsTxBuffer(wsFrameHeaderLength(payloadLength, mask) + payloadLength);
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  encodeWsFrame(buffer->data, payload, payloadLength, options, mask);
+  return buffer;
+}
+
+//***********************************************************************
+// Writes a whole uncompressed frame to out, which must have room for
+// wsFrameHeaderLength(payloadLength, mask) + payloadLength bytes, and
+// returns its length.
+static uint32_t ICACHE_FLASH_ATTR encodeWsFrame(uint8_t *out, const char *payload, uint32_t payloadLength, uint8_t options, bool mask) {
+  uint32_t maskingKey = mask ? os_random() : 0;
+  uint8_t headerLength = wsframe_encodeHeader(out, FLAG_FIN | options, payloadLength,
+                                              mask ? (const uint8_t *)&maskingKey : NULL);
+
+  if (payloadLength) {
+    os_memcpy(out + headerLength, payload, payloadLength); //payload may be NULL, as for a bare close
+  }
+  if (mask) {
+    unmaskWsPayload((char *)out + headerLength, payloadLength, maskingKey, 0);
+  }
+  return headerLength + payloadLength;
+}
+
+//***********************************************************************
+static uint8_t ICACHE_FLASH_ATTR wsFrameHeaderLength(uint32_t payloadLength, bool mask) {
+  uint8_t length = 2;
+  if (payloadLength > 0xFFFF) {
+    length += 8;
+  } else if (payloadLength > 125) {
+    length += 2;
+  }
+  return mask ? length + 4 : length;
+}
+
+#if WS_DEFLATE
+//***********************************************************************
+// Compresses a message into a new transmit buffer with RSV1 set (RFC 7692
+// section 6.1), or returns NULL if it doesn't get any smaller.  The buffer
+// is allocated for the longest frame worth sending and compressed into
+// directly, behind room for the longest header that could need; the real
+// header is then written just in front of the compressed data.
+static WSTxBuffer *ICACHE_FLASH_ATTR deflateWsFrame(const char *payload, uint32_t payloadLength, uint8_t options, uint8_t windowBits) {
+  uint32_t maxLength = payloadLength - 1;
+  uint8_t maxHeaderLength = wsFrameHeaderLength(maxLength, false);
+  WSTxBuffer *buffer = allocWsTxBuffer(maxHeaderLength + maxLength);
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  int32_t length = wsdeflate_compress((const uint8_t *)payload, payloadLength, buffer->data + maxHeaderLength, maxLength,
+                                      windowBits, WS_DEFLATE_MEM_LEVEL, wsDeflateWork);
+  if (length < 0) {
+    freeWsBlock(buffer);
+    return NULL;
+  }
+
+  uint8_t headerLength = wsFrameHeaderLength(length, false);
+  buffer->data += maxHeaderLength - headerLength;
+  buffer->length = headerLength + length;
+  wsframe_encodeHeader(buffer->data, FLAG_FIN | FLAG_RSV1 | options, length, NULL);
+  return buffer;
+}
+#endif
+
+//***********************************************************************
+// Queues raw bytes, such as the handshake response, for sending.
+static sint8 ICACHE_FLASH_ATTR sendWsRaw(WSConnection *connection, const char *data, uint32_t length) {
+  if (connection->txCount == connection->server->txQueueDepth) {
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  WSTxBuffer *buffer = allocWsTxBuffer(length);
+  if (buffer == NULL) {
+    return WS_ERR_MEM;
+  }
+  os_memcpy(buffer->data, data, length);
+
+  return queueWsTxBuffer(connection, buffer);
+}
+
+//***********************************************************************
+static void ICACHE_FLASH_ATTR initWsPools(void) {
+  wspool_init(&wsPools[WS_POOL_SMALL], wsPoolSmall, WS_POOL_SMALL_SIZE, WS_POOL_SMALL_COUNT);
+  wspool_init(&wsPools[WS_POOL_MEDIUM], wsPoolMedium, WS_POOL_MEDIUM_SIZE, WS_POOL_MEDIUM_COUNT);
+  wspool_init(&wsPools[WS_POOL_LARGE], wsPoolLarge, WS_POOL_LARGE_SIZE, WS_POOL_LARGE_COUNT);
+}
+
+//***********************************************************************
+// Takes size bytes from the smallest pool that has a big enough block free,
+// falling back to the heap when none has.
+static void *ICACHE_FLASH_ATTR allocWsBlock(uint32_t size) {
+  for (uint8_t pool = 0; pool < WS_POOL_COUNT; pool++) {
+    if (size <= wsPools[pool].stats.blockSize) {
+      void *block = wspool_alloc(&wsPools[pool]);
+      if (block != NULL) {
+        return block;
+      }
+    }
+  }
+  return os_malloc(size);
+}
+
+//***********************************************************************
+static void ICACHE_FLASH_ATTR freeWsBlock(void *block) {
+  for (uint8_t pool = 0; pool < WS_POOL_COUNT; pool++) {
+    if (wspool_owns(&wsPools[pool], block)) {
+      wspool_free(&wsPools[pool], block);
+      return;
+    }
+  }
+  os_free(block);
+}
+
+//***********************************************************************
+// Copies the usage counters of one of the WS_POOL_* buffer pools;
+// failures counts the times it was empty when a buffer of its size was
+// wanted.  Returns false for an unknown pool.
+bool ICACHE_FLASH_ATTR getWsPoolStats(uint8_t pool, WSPoolStats *stats) {
+  if (pool >= WS_POOL_COUNT) {
+    return false;
+  }
+  *stats = wsPools[pool].stats;
+  return true;
+}
+
+//***********************************************************************
+// Copies a lent message into a block of its own, for an application that
+// has to keep it past its view callback, such as to hand it to a task.
+// Returns NULL if there is no memory for it.  The copy must be given back
+// with releaseWsRetained.
+WSRetained *ICACHE_FLASH_ATTR retainWsView(const WSView *view) {
+  WSRetained *retained = (WSRetained *)allocWsBlock(sizeof(WSRetained) + view->length + 1);
+  if (retained == NULL) {
+    return NULL;
+  }
+  retained->opcode = view->opcode;
+  retained->length = view->length;
+  retained->data = (char *)(retained + 1);
+  os_memcpy(retained->data, view->data, view->length);
+  retained->data[view->length] = '\0';
+  return retained;
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR releaseWsRetained(WSRetained *retained) {
+  freeWsBlock(retained);
+}
+
+#if WS_LOG_LEVEL > WS_LOG_NONE
+//***********************************************************************
+// Formats one line into the log ring buffer, unless its call site has
+// logged within the last WS_LOG_INTERVAL milliseconds.  Nothing is printed
+// here, so this is safe in network callbacks.
+void ICACHE_FLASH_ATTR logWs(WSLogSite *site, uint8_t level, const char *format, ...) {
+  if (!wslog_allow(site, system_get_time(), WS_LOG_INTERVAL * 1000UL)) {
+    return;
+  }
+  if (wsLog.buffer == NULL) {
+    wslog_init(&wsLog, wsLogBuffer, sizeof(wsLogBuffer));
+  }
+
+  char line[WS_LOG_MAX_LINE];
+  int length = snprintf(line, sizeof(line), "%c ", wsLogLevels[level]);
+  if (site->suppressed != 0) {
+    length += snprintf(line + length, sizeof(line) - length, "(+%u) ", site->suppressed);
+    site->suppressed = 0;
+  }
+
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(line + length, sizeof(line) - length, format, args);
+  va_end(args);
+  if (written < 0) {
+    return;
+  }
+  length += written;
+  if (length >= (int)sizeof(line)) {
+    //cut short, but still a line
+    length = sizeof(line) - 1;
+    line[length - 1] = '\n';
+  }
+
+  wslog_write(&wsLog, line, length);
+}
+
+//***********************************************************************
+// Writes out what has been logged, as far as the serial port's transmit
+// buffer has room, so it never waits for the port.
+void ICACHE_FLASH_ATTR webSocketLogFlush( void ) {
+  if (wsLog.buffer == NULL) {
+    return;
+  }
+
+  char chunk[64];
+  int room = Serial.availableForWrite();
+  while (room > 0) {
+    uint16_t length = wslog_read(&wsLog, chunk, (room < (int)sizeof(chunk)) ? room : sizeof(chunk));
+    if (length == 0) {
+      break;
+    }
+    Serial.write((const uint8_t *)chunk, length);
+    room -= length;
+  }
+
+  if (wsLog.dropped != wsLogDroppedReported && wsLog.head == wsLog.tail) {
+    int length = snprintf(chunk, sizeof(chunk), "W (%u log lines lost)\n", (unsigned)(wsLog.dropped - wsLogDroppedReported));
+    if (length <= room) {
+      Serial.write((const uint8_t *)chunk, length);
+      wsLogDroppedReported = wsLog.dropped;
+    }
+  }
+}
+#endif
+
+#if WS_METRICS
+//***********************************************************************
+static void ICACHE_FLASH_ATTR countWsFrame(uint32_t *frames, uint32_t *bytes, uint8_t opcode, uint32_t payloadLength) {
+  uint8_t index = wsMetricsOpcodes[opcode & OPCODE_MASK];
+  frames[index]++;
+  bytes[index] += payloadLength;
+}
+
+//***********************************************************************
+// Adds one set of counters to another; the handshake time and queue high
+// water keep the larger of the two.
+static void ICACHE_FLASH_ATTR addWsMetrics(WSMetrics *total, const WSMetrics *metrics) {
+  total->accepted += metrics->accepted;
+  total->slotRejections += metrics->slotRejections;
+  total->handshakeRejections += metrics->handshakeRejections;
+  if (metrics->handshakeTime > total->handshakeTime) {
+    total->handshakeTime = metrics->handshakeTime;
+  }
+  for (uint8_t i = 0; i < WS_METRICS_OPCODES; i++) {
+    total->framesIn[i] += metrics->framesIn[i];
+    total->bytesIn[i] += metrics->bytesIn[i];
+    total->framesOut[i] += metrics->framesOut[i];
+    total->bytesOut[i] += metrics->bytesOut[i];
+  }
+  total->parseCycles += metrics->parseCycles;
+  total->unmaskCycles += metrics->unmaskCycles;
+  total->sentFailures += metrics->sentFailures;
+  total->superseded += metrics->superseded;
+  if (metrics->txQueueHighWater > total->txQueueHighWater) {
+    total->txQueueHighWater = metrics->txQueueHighWater;
+  }
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR getWsConnectionMetrics(WSConnection *connection, WSMetrics *snapshot) {
+  *snapshot = connection->metrics;
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR getWsServerMetrics(WSServer *server, WSMetrics *snapshot) {
+  *snapshot = server->metrics;
+  for (uint8_t slotId = 0; slotId < server->maxConnections; slotId++) {
+    addWsMetrics(snapshot, &server->connections[slotId].metrics);
+  }
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR getWsMetrics(WSMetrics *snapshot) {
+  getWsServerMetrics(&defaultWsServer(), snapshot);
+}
+
+//***********************************************************************
+// Writes a snapshot as one line of JSON, up to WS_METRICS_JSON_MAX bytes
+// with the NUL.  Returns its length, or -1 if it didn't fit.
+int ICACHE_FLASH_ATTR formatWsMetricsJson(const WSMetrics *metrics, char *buffer, int bufferSize) {
+  int length = snprintf(buffer, bufferSize,
+                        "{\"accepted\":%u,\"slotRejections\":%u,\"handshakeRejections\":%u,\"handshakeTime\":%u,"
+                        "\"parseCycles\":%u,\"unmaskCycles\":%u,\"sentFailures\":%u,\"superseded\":%u,"
+                        "\"txQueueHighWater\":%u",
+                        (unsigned)metrics->accepted, (unsigned)metrics->slotRejections,
+                        (unsigned)metrics->handshakeRejections, (unsigned)metrics->handshakeTime,
+                        (unsigned)metrics->parseCycles, (unsigned)metrics->unmaskCycles,
+                        (unsigned)metrics->sentFailures, (unsigned)metrics->superseded,
+                        (unsigned)metrics->txQueueHighWater);
+  if (length < 0 || length >= bufferSize) {
+    return -1;
+  }
+  const char *names[4] = { "framesIn", "bytesIn", "framesOut", "bytesOut" };
+  const uint32_t *counters[4] = { metrics->framesIn, metrics->bytesIn, metrics->framesOut, metrics->bytesOut };
+  for (uint8_t i = 0; i < 4; i++) {
+    int written = formatWsCounters(buffer + length, bufferSize - length, names[i], counters[i]);
+    if (written < 0) {
+      return -1;
+    }
+    length += written;
+  }
+  if (length + 2 > bufferSize) {
+    return -1;
+  }
+  buffer[length++] = '}';
+  buffer[length] = '\0';
+  return length;
+}
+
+//***********************************************************************
+// Appends ,"name":[...] with one entry per WS_METRICS_OPCODES.
+static int ICACHE_FLASH_ATTR formatWsCounters(char *buffer, int bufferSize, const char *name, const uint32_t *counters) {
+  int length = snprintf(buffer, bufferSize, ",\"%s\":[", name);
+  for (uint8_t i = 0; i < WS_METRICS_OPCODES && length >= 0 && length < bufferSize; i++) {
+    length += snprintf(buffer + length, bufferSize - length, (i == 0) ? "%u" : ",%u", (unsigned)counters[i]);
+  }
+  if (length < 0 || length + 1 >= bufferSize) {
+    return -1;
+  }
+  buffer[length++] = ']';
+  buffer[length] = '\0';
+  return length;
+}
+#endif
+
+//***********************************************************************
+static WSTxBuffer *ICACHE_FLASH_ATTR allocWsTxBuffer(uint32_t length) {
+  WSTxBuffer *buffer = (WSTxBuffer *)allocWsBlock(sizeof(WSTxBuffer) + length);
+  if (buffer != NULL) {
+    buffer->refCount = 1;
+    buffer->latestKey = 0;
+    buffer->length = length;
+    buffer->data = (uint8_t *)(buffer + 1);
+    buffer->onSent = NULL;
+  }
+  return buffer;
+}
+
+//***********************************************************************
+static void ICACHE_FLASH_ATTR releaseWsTxBuffer(WSTxBuffer *buffer) {
+  if (--buffer->refCount == 0) {
+    if (buffer->onSent != NULL) {
+      //hand a borrowed payload back to its owner
+      buffer->onSent((const char *)buffer->data, buffer->sentContext);
+    }
+    freeWsBlock(buffer);
+  }
+}
+
+//***********************************************************************
+// Appends a buffer to the connection's transmit queue, which takes over one
+// reference to it, and starts sending if the connection is idle.
+static sint8 ICACHE_FLASH_ATTR queueWsTxBuffer(WSConnection *connection, WSTxBuffer *buffer) {
+  if (connection->connection == NULL) {
+    //dropped, perhaps by a failed send of what was queued just before
+    releaseWsTxBuffer(buffer);
+    return WS_ERR_CLOSED;
+  }
+  if (connection->txCount == connection->server->txQueueDepth) {
+    releaseWsTxBuffer(buffer);
+    return WS_ERR_WOULD_BLOCK;
+  }
+
+  uint8_t slot = connection->txHead + connection->txCount;
+  if (slot >= connection->server->txQueueDepth) {
+    slot -= connection->server->txQueueDepth;
+  }
+  connection->txQueue[slot] = buffer;
+  connection->txCount++;
+#if WS_METRICS
+  if (connection->txCount > connection->metrics.txQueueHighWater) {
+    connection->metrics.txQueueHighWater = connection->txCount;
+  }
+#endif
+
+  if (connection->txCount == connection->server->txHighWater && connection->server->onHighWater != NULL) {
+    connection->server->onHighWater(connection, connection->txCount);
+  }
+
+  sendWsTxQueue(connection);
+  return WS_OK;
+}
+
+//***********************************************************************
+// Starts sending the next queued data, unless a send is already in flight.
+// The SDK doesn't copy the data, so the buffer is kept in txInFlight until
+// webSocketSentCb reports that all of it has gone.  Small frames that have
+// piled up behind a send are coalesced into one espconn_sent.
+static void ICACHE_FLASH_ATTR sendWsTxQueue(WSConnection *connection) {
+  if (connection->txInFlight != NULL) {
+    resumeWsTx(connection);
+    return;
+  }
+  if (connection->txCount == 0) {
+    return;
+  }
+
+  WSTxBuffer *buffer = connection->txQueue[connection->txHead];
+  uint32_t length = buffer->length;
+  uint8_t count = 1;
+  uint8_t slot = nextWsTxSlot(connection, connection->txHead);
+
+  while (count < connection->txCount) {
+    uint32_t nextLength = connection->txQueue[slot]->length;
+    if (length + nextLength > WS_TX_MSS) {
+      break;
+    }
+    length += nextLength;
+    count++;
+    slot = nextWsTxSlot(connection, slot);
+  }
+
+  if (count > 1) {
+    WSTxBuffer *coalesced = allocWsTxBuffer(length);
+    if (coalesced == NULL) {
+      count = 1; //just send the first one
+      slot = nextWsTxSlot(connection, connection->txHead);
+    } else {
+      uint8_t *data = coalesced->data;
+      uint8_t i = connection->txHead;
+      for (uint8_t n = 0; n < count; n++) {
+        WSTxBuffer *queued = connection->txQueue[i];
+        os_memcpy(data, queued->data, queued->length);
+        data += queued->length;
+        releaseWsTxBuffer(queued);
+        i = nextWsTxSlot(connection, i);
+      }
+      buffer = coalesced;
+    }
+  }
+
+  connection->txHead = slot;
+  connection->txCount -= count;
+  connection->txInFlight = buffer;
+  connection->txOffset = 0;
+
+  sendWsTxChunk(connection);
+}
+
+//***********************************************************************
+// The queue entry after slot.  Queue depths aren't fixed at compile time,
+// so this saves a division.
+static uint8_t ICACHE_FLASH_ATTR nextWsTxSlot(WSConnection *connection, uint8_t slot) {
+  slot++;
+  return (slot == connection->server->txQueueDepth) ? 0 : slot;
+}
+
+//***********************************************************************
+// Hands the next piece of txInFlight to espconn_sent.  Borrowed payloads
+// are streamed a segment at a time, our own buffers go in one piece.
+static void ICACHE_FLASH_ATTR sendWsTxChunk(WSConnection *connection) {
+  WSTxBuffer *buffer = connection->txInFlight;
+  uint32_t chunk = buffer->length - connection->txOffset;
+  uint32_t maxChunk = (buffer->onSent != NULL) ? WS_TX_MSS : 0xFFFF;
+
+  if (chunk > maxChunk) {
+    chunk = maxChunk;
+  }
+  connection->txChunk = chunk;
+  unstallWsTx(connection);
+
+  sint8 ret = espconn_sent(connection->connection, buffer->data + connection->txOffset, chunk);
+  if (ret == ESPCONN_MEM || ret == ESPCONN_MAXNUM || ret == ESPCONN_INPROGRESS) {
+    //the SDK is short of memory or busy.  The chunk stays in flight, with
+    //the frames coalesced into it, until resumeWsTx gets it accepted
+    wsLogWarn("webSocket espconn_sent failed ret=%d, will retry\n", ret);
+#if WS_METRICS
+    connection->metrics.sentFailures++;
+#endif
+    stallWsTx(connection);
+  } else if (ret != 0) {
+    //the tcp connection is broken.  Sending the rest of the queue would put
+    //frames on the wire with pieces missing - a borrowed payload without its
+    //header - so the connection is dropped with everything queued on it
+    wsLogError("webSocket espconn_sent failed ret=%d, dropping the connection\n", ret);
+#if WS_METRICS
+    connection->metrics.sentFailures++;
+#endif
+    reapWsConnection(connection);
+  }
+}
+
+//***********************************************************************
+// Offers espconn_sent the chunk it last refused again.  Tried whenever more
+// is queued or received on the connection, and on every timer tick, as the
+// SDK says nothing when it has room again.
+static void ICACHE_FLASH_ATTR resumeWsTx(WSConnection *connection) {
+  if (connection->txStalledPrev != NULL && connection->connection != NULL) {
+    sendWsTxChunk(connection);
+  }
+}
+
+//***********************************************************************
+// Puts the connection on the server's list of refused chunks, so the timer
+// only retries those rather than looking at every slot.
+static void ICACHE_FLASH_ATTR stallWsTx(WSConnection *connection) {
+  if (connection->txStalledPrev != NULL) {
+    return;
+  }
+  WSServer *server = connection->server;
+  connection->txStalledNext = server->txStalled;
+  if (server->txStalled != NULL) {
+    server->txStalled->txStalledPrev = &connection->txStalledNext;
+  }
+  connection->txStalledPrev = &server->txStalled;
+  server->txStalled = connection;
+}
+
+//***********************************************************************
+static void ICACHE_FLASH_ATTR unstallWsTx(WSConnection *connection) {
+  if (connection->txStalledPrev == NULL) {
+    return;
+  }
+  *connection->txStalledPrev = connection->txStalledNext;
+  if (connection->txStalledNext != NULL) {
+    connection->txStalledNext->txStalledPrev = connection->txStalledPrev;
+  }
+  connection->txStalledPrev = NULL;
+  connection->txStalledNext = NULL;
+}
+
+//***********************************************************************
+// A closed connection is dropped once its last frame (or handshake
+// response) has been sent.
+static void ICACHE_FLASH_ATTR disconnectWsIfIdle(WSConnection *connection) {
+  if (connection->status == STATUS_CLOSED && connection->connection != NULL &&
+      connection->txInFlight == NULL && connection->txCount == 0) {
+    espconn_disconnect(connection->connection);
+  }
+}
+
+//***********************************************************************
+// Drops everything still waiting to be sent.
+static void ICACHE_FLASH_ATTR flushWsTxQueue(WSConnection *connection) {
+  while (connection->txCount > 0) {
+    releaseWsTxBuffer(connection->txQueue[connection->txHead]);
+    connection->txHead = nextWsTxSlot(connection, connection->txHead);
+    connection->txCount--;
+  }
+  if (connection->txInFlight != NULL) {
+    releaseWsTxBuffer(connection->txInFlight);
+    connection->txInFlight = NULL;
+  }
+  connection->txHead = 0;
+  unstallWsTx(connection);
+}
+
+//***********************************************************************
+void ICACHE_FLASH_ATTR webSocketSentCb(void *arg) {
+  //data sent successfully
+  struct espconn *requestconn = (espconn *)arg;
+
+  WSConnection *wsConnection = getWsConnection(requestconn);
+  if (wsConnection == NULL) {
+    return;
+  }
+
+  if (wsConnection->txInFlight != NULL) {
+    wsConnection->txOffset += wsConnection->txChunk;
+    if (wsConnection->txOffset < wsConnection->txInFlight->length) {
+      sendWsTxChunk(wsConnection);
+      return;
+    }
+    releaseWsTxBuffer(wsConnection->txInFlight);
+    wsConnection->txInFlight = NULL;
+  }
+  sendWsTxQueue(wsConnection);
+  disconnectWsIfIdle(wsConnection);
+}
+
+/***********************************************************************/
+void ICACHE_FLASH_ATTR webSocketDisconCb(void *arg) {
+  espconn *esp_connection = (espconn*)arg;
+
+  WSConnection *wsConn = getWsConnection( esp_connection);
+  if ( wsConn != NULL ) {
+    releaseWsConnection(wsConn);
+    wsLogDebug("webSocket disconnected\n");
+    return;
+  }
+
+  wsLogDebug("webSocket disconnect of an unknown connection\n");
+  return;
+}
+
+/***********************************************************************/
+// The SDK reports a connection that was reset or failed here, instead of
+// through the disconnect callback.
+void ICACHE_FLASH_ATTR webSocketReconCb(void *arg, sint8 err) {
+  (void)err; //only logged, which may be compiled out
+  wsLogInfo("webSocket connection reset err=%d\n", err);
+
+  WSConnection *wsConn = getWsConnection((espconn *)arg);
+  if (wsConn != NULL) {
+    releaseWsConnection(wsConn);
+  }
+}
+
+/***********************************************************************/
+// The tcp connection is gone: drop what was waiting to be sent and free the
+// slot for the next connection.
+static void ICACHE_FLASH_ATTR releaseWsConnection(WSConnection *connection) {
+  WSServer *server = connection->server;
+  for (int8_t topic = 0; topic < server->topicCount; topic++) {
+    unsubscribeWsTopic(connection, topic);
+  }
+  cancelWsTimer(connection);
+  connection->status = STATUS_CLOSED;
+  flushWsTxQueue(connection);
+  connection->connection = NULL;
+#if WS_METRICS
+  addWsMetrics(&connection->server->metrics, &connection->metrics);
+  os_memset(&connection->metrics, 0, sizeof(WSMetrics));
+#endif
+}
+
+/***********************************************************************/
+// Drops a connection that has stopped responding.  It is aborted rather
+// than disconnected, as a dead peer would never complete the tcp close.
+static void ICACHE_FLASH_ATTR reapWsConnection(WSConnection *connection) {
+  struct espconn *esp_connection = connection->connection;
+
+  wsLogInfo("webSocket reaping %d.%d.%d.%d:%d\n", connection->remoteIp[0], connection->remoteIp[1],
+            connection->remoteIp[2], connection->remoteIp[3], connection->remotePort);
+  releaseWsConnection(connection);
+  espconn_abort(esp_connection);
+}
+
+/***********************************************************************/
+// Sets the connection's one timer to fire in ticks timer ticks, replacing
+// any that was set.
+static void ICACHE_FLASH_ATTR scheduleWsTimer(WSConnection *connection, uint32_t ticks) {
+  cancelWsTimer(connection);
+
+  WSServer *server = connection->server;
+  connection->timerExpires = server->timerTick + (ticks > 0 ? ticks : 1);
+  WSConnection **slot = &server->timerWheel[connection->timerExpires & (WS_TIMER_SLOTS - 1)];
+  connection->timerNext = *slot;
+  if (*slot != NULL) {
+    (*slot)->timerPrev = &connection->timerNext;
+  }
+  connection->timerPrev = slot;
+  *slot = connection;
+}
+
+/***********************************************************************/
+static void ICACHE_FLASH_ATTR cancelWsTimer(WSConnection *connection) {
+  if (connection->timerPrev == NULL) {
+    return;
+  }
+  *connection->timerPrev = connection->timerNext;
+  if (connection->timerNext != NULL) {
+    connection->timerNext->timerPrev = connection->timerPrev;
+  }
+  connection->timerPrev = NULL;
+  connection->timerNext = NULL;
+}
+
+/***********************************************************************/
+// Turns the timer wheel by one tick.  Only the slot for this tick is looked
+// at; the connections in it that aren't due yet are waiting for a later
+// turn of the wheel.  Chunks the SDK refused are offered again too.
+void ICACHE_FLASH_ATTR webSocketTimerCb(void *arg) {
+  WSServer *server = (WSServer *)arg;
+  server->timerTick++;
+
+  WSConnection *connection = server->timerWheel[server->timerTick & (WS_TIMER_SLOTS - 1)];
+  while (connection != NULL) {
+    WSConnection *next = connection->timerNext;
+    if (connection->timerExpires == server->timerTick) {
+      cancelWsTimer(connection);
+      expireWsTimer(connection);
+    }
+    connection = next;
+  }
+
+  //one refused again goes back on the front of the list, behind us
+  connection = server->txStalled;
+  while (connection != NULL) {
+    WSConnection *next = connection->txStalledNext;
+    resumeWsTx(connection);
+    connection = next;
+  }
+
+  //outside any network callback, so a good time to print the log
+  webSocketLogFlush();
+}
+
+/***********************************************************************/
+// An open connection is pinged, unless too many pings have gone unanswered
+// already.  A connection whose timer runs out in any other state has
+// overstayed the handshake or its close.
+static void ICACHE_FLASH_ATTR expireWsTimer(WSConnection *connection) {
+  if (connection->connection == NULL) {
+    return;
+  }
+
+  if (connection->status != STATUS_OPEN || connection->pingsUnanswered >= WS_PING_MAX_MISSED) {
+    reapWsConnection(connection);
+    return;
+  }
+
+  //the ping carries the time it was sent, so the pong tells the round trip time
+  connection->pingSentAt = system_get_time();
+  sendWsMessage(connection, (const char *)&connection->pingSentAt, sizeof(connection->pingSentAt), OPCODE_PING);
+  connection->pingsUnanswered++;
+  scheduleWsTimer(connection, WS_PING_INTERVAL);
 }
 
 
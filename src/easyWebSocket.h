@@ -3,116 +3,572 @@
 #ifndef   _MESH_WEB_SOCKET_H_
 #define   _MESH_WEB_SOCKET_H_
 
+extern "C" {
+#include "user_interface.h"
+#include "espconn.h"
+}
+#include "wsframe.h"
+#include "wspool.h"
+#include "wslog.h"
+
 #define WEB_SOCKET_PORT   2222
 
-#define WS_KEY_IDENTIFIER "Sec-WebSocket-Key: "
 #define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#define WS_RESPONSE "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"
+#define WS_KEY_LENGTH 24 //base64 of the client's 16 byte nonce
+#define WS_RESPONSE "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n"
+#define WS_RESPONSE_PROTOCOL "Sec-WebSocket-Protocol: %s\r\n"
+#define WS_RESPONSE_DEFLATE "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover; server_max_window_bits=%d\r\n"
+#define WS_RESPONSE_400 "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"
+#define WS_RESPONSE_403 "HTTP/1.1 403 Forbidden\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"
+#define WS_RESPONSE_426 "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"
 #define HTML_HEADER_LINEEND "\r\n"
+#define WS_REQUEST "GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n"
+#define WS_STATUS_101 "HTTP/1.1 101"
+#define WS_NONCE_LENGTH 16
 
+//upgrade request parsing.  An Origin or Sec-WebSocket-Protocol value longer
+//than WS_HANDSHAKE_MAX_VALUE gets a 400 if it would be checked (there is an
+//origin callback, or a protocol is set), a longer extensions offer is
+//declined, and longer values of the other headers we look at are
+//truncated; headers we don't look at may be any length
+#define WS_HANDSHAKE_MAX_NAME 24
+#define WS_HANDSHAKE_MAX_VALUE 64
+#define WS_HANDSHAKE_MAX_RESPONSE 384
+
+//WS_MAXCONN, WS_MAX_MESSAGE_SIZE and WS_TX_QUEUE_DEPTH size the default
+//server used by webSocketInit and the other plain functions.  A
+//WebSocketServer<> (below) is sized by its template parameters instead.
+//
 //we normally dont need that many connection, however a single 
-//connection only allocates a WSConnection struct and is therefore really small
+//connection only allocates a WSConnection struct and is therefore really small.
+//Connections are found through espconn.reverse, so more slots don't slow
+//down the per packet lookup
+#ifndef WS_MAXCONN
 #define WS_MAXCONN 4
-#define CONN_TIMEOUT 60*60*12
-
-/* from IEEE RFC6455 sec 5.2
-      0                   1                   2                   3
-      0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-     +-+-+-+-+-------+-+-------------+-------------------------------+
-     |F|R|R|R| opcode|M| Payload len |    Extended payload length    |
-     |I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
-     |N|V|V|V|       |S|             |   (if payload len==126/127)   |
-     | |1|2|3|       |K|             |                               |
-     +-+-+-+-+-------+-+-------------+ - - - - - - - - - - - - - - - +
-     |     Extended payload length continued, if payload len == 127  |
-     + - - - - - - - - - - - - - - - +-------------------------------+
-     |                               |Masking-key, if MASK set to 1  |
-     +-------------------------------+-------------------------------+
-     | Masking-key (continued)       |          Payload Data         |
-     +-------------------------------- - - - - - - - - - - - - - - - +
-     :                     Payload Data continued ...                :
-     + - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - +
-     |                     Payload Data continued ...                |
-     +---------------------------------------------------------------+
-*/
-
-#define FLAG_FIN (1 << 7)
-#define FLAG_RSV1 (1 << 6)
-#define FLAG_RSV2 (1 << 5)
-#define FLAG_RSV3 (1 << 4)
-
-#define OPCODE_CONTINUE 0x0
-#define OPCODE_TEXT 0x1
-#define OPCODE_BINARY 0x2
-#define OPCODE_CLOSE 0x8
-#define OPCODE_PING 0x9
-#define OPCODE_PONG 0xA
-
-#define FLAGS_MASK ((uint8_t)0xF0)
-#define OPCODE_MASK ((uint8_t)0x0F)
-#define IS_MASKED ((uint8_t)(1<<7))
-#define PAYLOAD_MASK ((uint8_t)0x7F)
+#endif
+//the SDK's own inactivity timeout in seconds, at most 7200.  Only a
+//backstop, the keepalive below finds dead connections much sooner
+#define CONN_TIMEOUT 7200
+
+//keepalive.  A timer wheel of WS_TIMER_SLOTS slots, turned every
+//WS_TIMER_TICK ms by one os_timer, pings each open connection every
+//WS_PING_INTERVAL ticks and drops it once WS_PING_MAX_MISSED pings in a row
+//have gone unanswered.  Connections still in the handshake after
+//WS_HANDSHAKE_TIMEOUT ticks, or still there WS_CLOSE_TIMEOUT ticks after
+//being closed, are dropped too.  Delays longer than the wheel take more
+//than one turn.
+#ifndef WS_TIMER_TICK
+#define WS_TIMER_TICK 1000
+#endif
+#define WS_TIMER_SLOTS 32 //a power of two
+#ifndef WS_PING_INTERVAL
+#define WS_PING_INTERVAL 30
+#endif
+#ifndef WS_PING_MAX_MISSED
+#define WS_PING_MAX_MISSED 2
+#endif
+#ifndef WS_HANDSHAKE_TIMEOUT
+#define WS_HANDSHAKE_TIMEOUT 10
+#endif
+#ifndef WS_CLOSE_TIMEOUT
+#define WS_CLOSE_TIMEOUT 5
+#endif
+
+//largest message that will be accepted.  Each connection has a buffer of
+//this size in which fragmented messages and frames split across several tcp
+//segments are assembled.  The default fits one tcp segment.
+#ifndef WS_MAX_MESSAGE_SIZE
+#define WS_MAX_MESSAGE_SIZE 1460
+#endif
+
+//frames waiting to be sent on a connection.  sendWsMessage returns
+//WS_ERR_WOULD_BLOCK once WS_TX_QUEUE_DEPTH frames are queued, and the high
+//water callback fires when the queue reaches WS_TX_HIGH_WATER frames.
+#ifndef WS_TX_QUEUE_DEPTH
+#define WS_TX_QUEUE_DEPTH 8
+#endif
+#ifndef WS_TX_HIGH_WATER
+#define WS_TX_HIGH_WATER (WS_TX_QUEUE_DEPTH * 3 / 4)
+#endif
+#define WS_TX_MSS 1460 //small queued frames are coalesced up to this size
+
+//transmit buffers are taken from three pools of fixed size blocks, shared by
+//all servers, so sending never fragments the heap.  A buffer comes from the
+//smallest pool whose blocks fit it, or the next larger one if that pool is
+//empty; only buffers too big for any pool, or sent while every pool is
+//empty, are allocated with os_malloc.  A block holds the buffer's bookkeeping
+//as well as the frame, see getWsPoolStats.  Messages kept with retainWsView
+//come from the same pools.
+#ifndef WS_POOL_SMALL_SIZE
+#define WS_POOL_SMALL_SIZE 64
+#endif
+#ifndef WS_POOL_SMALL_COUNT
+#define WS_POOL_SMALL_COUNT 16
+#endif
+#ifndef WS_POOL_MEDIUM_SIZE
+#define WS_POOL_MEDIUM_SIZE 512
+#endif
+#ifndef WS_POOL_MEDIUM_COUNT
+#define WS_POOL_MEDIUM_COUNT 8
+#endif
+#ifndef WS_POOL_LARGE_SIZE
+#define WS_POOL_LARGE_SIZE 1536 //a coalesced WS_TX_MSS chunk
+#endif
+#ifndef WS_POOL_LARGE_COUNT
+#define WS_POOL_LARGE_COUNT 2
+#endif
+#define WS_POOL_SMALL 0
+#define WS_POOL_MEDIUM 1
+#define WS_POOL_LARGE 2
+#define WS_POOL_COUNT 3
+
+//static_assert limit on the RAM a WebSocketServer<> takes
+#ifndef WS_RAM_BUDGET
+#define WS_RAM_BUDGET 24576
+#endif
+#define WS_MAX_CONTROL_PAYLOAD 125
+
+//permessage-deflate (RFC 7692), accepted when a client offers it.  Both
+//directions use no_context_takeover, so nothing is kept between messages:
+//an outgoing message is compressed with a 2^WS_DEFLATE_WINDOW_BITS byte
+//window (8-15) and a 2^(WS_DEFLATE_MEM_LEVEL+7) entry hash table, held in one
+//static work area (3 KB at the defaults) straight into a transmit buffer,
+//and received messages are inflated into one WS_MAX_MESSAGE_SIZE buffer
+//shared by all connections.  Messages shorter
+//than WS_DEFLATE_MIN_SIZE, or that don't get any smaller, are sent as they are.
+#ifndef WS_DEFLATE
+#define WS_DEFLATE 1
+#endif
+#ifndef WS_DEFLATE_WINDOW_BITS
+#define WS_DEFLATE_WINDOW_BITS 10
+#endif
+#ifndef WS_DEFLATE_MEM_LEVEL
+#define WS_DEFLATE_MEM_LEVEL 2
+#endif
+#ifndef WS_DEFLATE_MIN_SIZE
+#define WS_DEFLATE_MIN_SIZE 64
+#endif
+
+//runtime counters, per connection and per server, read as a WSMetrics
+//snapshot with getWsConnectionMetrics or getWsServerMetrics.  With
+//WS_METRICS 0 the counters, and the code that updates them, are left out.
+//WS_CYCLE_COUNT reads the cpu cycle counter used to time the frame parser.
+#ifndef WS_METRICS
+#define WS_METRICS 1
+#endif
+#ifndef WS_CYCLE_COUNT
+#define WS_CYCLE_COUNT() ESP.getCycleCount()
+#endif
+#define WS_METRICS_OPCODES 7 //continue, text, binary, close, ping, pong, reserved
+#define WS_METRICS_JSON_MAX 768
+
+//logging.  Calls above WS_LOG_LEVEL compile to nothing.  The rest format
+//their line into a WS_LOG_BUFFER_SIZE ring buffer instead of printing it,
+//and webSocketLogFlush - called by the keepalive timer, or from loop() -
+//writes out as much as the serial port takes without blocking.  Each call
+//site logs at most one line per WS_LOG_INTERVAL milliseconds, noting how
+//many it held back.
+#define WS_LOG_NONE 0
+#define WS_LOG_ERROR 1
+#define WS_LOG_WARN 2
+#define WS_LOG_INFO 3
+#define WS_LOG_DEBUG 4
+#ifndef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_WARN
+#endif
+#ifndef WS_LOG_BUFFER_SIZE
+#define WS_LOG_BUFFER_SIZE 512 //a power of two
+#endif
+#ifndef WS_LOG_INTERVAL
+#define WS_LOG_INTERVAL 1000
+#endif
+#define WS_LOG_MAX_LINE 96
+
+#define WS_LOG_AT(level, ...) do { static WSLogSite wsLogSite; logWs(&wsLogSite, level, __VA_ARGS__); } while (0)
+#if WS_LOG_LEVEL >= WS_LOG_ERROR
+#define wsLogError(...) WS_LOG_AT(WS_LOG_ERROR, __VA_ARGS__)
+#else
+#define wsLogError(...) do { } while (0)
+#endif
+#if WS_LOG_LEVEL >= WS_LOG_WARN
+#define wsLogWarn(...) WS_LOG_AT(WS_LOG_WARN, __VA_ARGS__)
+#else
+#define wsLogWarn(...) do { } while (0)
+#endif
+#if WS_LOG_LEVEL >= WS_LOG_INFO
+#define wsLogInfo(...) WS_LOG_AT(WS_LOG_INFO, __VA_ARGS__)
+#else
+#define wsLogInfo(...) do { } while (0)
+#endif
+#if WS_LOG_LEVEL >= WS_LOG_DEBUG
+#define wsLogDebug(...) WS_LOG_AT(WS_LOG_DEBUG, __VA_ARGS__)
+#else
+#define wsLogDebug(...) do { } while (0)
+#endif
+
+//publish/subscribe.  A server has up to WS_MAX_TOPICS topics, added with
+//addWsTopic, each with a bit per connection slot for its subscribers.  The
+//application subscribes connections with subscribeWsTopic; a server can
+//also let clients subscribe themselves (setSubscriptionMessages), by
+//sending the text message WS_SUBSCRIBE followed by the topic's name, and
+//unsubscribe with WS_UNSUBSCRIBE and the name, in which case these
+//messages aren't passed on to the application.  publishWsTopic encodes a
+//message once and queues it for the topic's subscribers only.
+#ifndef WS_MAX_TOPICS
+#define WS_MAX_TOPICS 16 //a power of two
+#endif
+#define WS_TOPIC_HASH_SLOTS (WS_MAX_TOPICS * 2)
+#ifndef WS_SUBSCRIBE
+#define WS_SUBSCRIBE "subscribe:"
+#endif
+#ifndef WS_UNSUBSCRIBE
+#define WS_UNSUBSCRIBE "unsubscribe:"
+#endif
+#define WS_NO_TOPIC -1
+#define WS_SUBSCRIBER_WORDS(maxConnections) (((maxConnections) + 31) / 32)
 
 #define STATUS_OPEN 0
 #define STATUS_CLOSED 1
 #define STATUS_UNINITIALISED 2
 
-#define CLOSE_MESSAGE {FLAG_FIN | OPCODE_CLOSE, IS_MASKED /* + payload = 0*/, 0 /* + masking key*/}
-#define CLOSE_MESSAGE_LENGTH 3
+#define WS_OK 0
+#define WS_ERR_WOULD_BLOCK -1
+#define WS_ERR_MEM -2
+#define WS_ERR_CLOSED -3 //the connection has gone
+
+#define HS_STATE_REQUEST_LINE 0
+#define HS_STATE_NAME 1
+#define HS_STATE_VALUE 2
+
+#define HS_HEADER_UPGRADE 0
+#define HS_HEADER_CONNECTION 1
+#define HS_HEADER_KEY 2
+#define HS_HEADER_VERSION 3
+#define HS_HEADER_ORIGIN 4
+#define HS_HEADER_PROTOCOL 5
+#define HS_HEADER_EXTENSIONS 6
+#define HS_HEADER_ACCEPT 7
+#define HS_HEADER_COUNT 8
+#define HS_HEADER_NONE 0xFF
+
+#define HS_FLAG_UPGRADE (1 << 0)
+#define HS_FLAG_CONNECTION (1 << 1)
+#define HS_FLAG_KEY (1 << 2)
+#define HS_FLAG_VERSION (1 << 3)
+#define HS_FLAG_PROTOCOL (1 << 4)
+#define HS_FLAG_BAD_VERSION (1 << 5)
+#define HS_FLAG_BAD_ORIGIN (1 << 6)
+#define HS_FLAG_ACCEPT (1 << 7)
+#define HS_FLAG_BAD_RESPONSE (1 << 8) //a response header a client can't go along with
+#define HS_FLAG_TOO_LONG (1 << 9) //an Origin or Sec-WebSocket-Protocol value was cut short
+#define HS_FLAGS_REQUIRED (HS_FLAG_UPGRADE | HS_FLAG_CONNECTION | HS_FLAG_KEY | HS_FLAG_VERSION)
+#define HS_FLAGS_CLIENT_REQUIRED (HS_FLAG_UPGRADE | HS_FLAG_CONNECTION | HS_FLAG_ACCEPT)
 
-typedef struct WSFrame WSFrame;
+#define RX_STATE_HEADER 0
+#define RX_STATE_PAYLOAD 1
+
+//unmasking works a machine word at a time, 64 bits where the cpu has them
+#if UINTPTR_MAX > 0xFFFFFFFFu
+typedef uint64_t __attribute__((__may_alias__)) WSMaskWord;
+#else
+typedef uint32_t __attribute__((__may_alias__)) WSMaskWord;
+#endif
+
+typedef struct WSServer WSServer;
 typedef struct WSConnection WSConnection;
+typedef struct WSTxBuffer WSTxBuffer;
+typedef struct WSHandshake WSHandshake;
+typedef struct WSMetrics WSMetrics;
+typedef struct WSTopic WSTopic;
+typedef struct WSView WSView;
+typedef struct WSRetained WSRetained;
+typedef struct WSBatch WSBatch;
 
 typedef void (* WSOnMessage)(char *payloadData);
+typedef void (* WSOnData)(WSConnection *connection,
+                          uint8_t opcode,
+                          const char *payload,
+                          uint32_t length,
+                          void *userContext);
+typedef void (* WSOnView)(const WSView *view, void *userContext);
 typedef void (* WSOnConnection)(void);
+typedef void (* WSOnHighWater)(WSConnection *connection, uint8_t queuedFrames);
+typedef void (* WSOnSent)(const char *payload, void *context);
+typedef bool (* WSOnOrigin)(const char *origin, uint8_t length);
+
+//frames being packed into one transmit buffer, between beginWsBatch and
+//flushWsBatch or abortWsBatch
+struct WSBatch {
+  WSConnection *connection;
+  WSTxBuffer *buffer;      //its length is the bytes packed so far
+#if WS_METRICS
+  uint32_t framesOut[WS_METRICS_OPCODES]; //added to the connection's once queued
+  uint32_t bytesOut[WS_METRICS_OPCODES];
+#endif
+};
 
-struct WSFrame {
-  uint8_t flags;
+//a received message, lent to the view callback.  data points into the
+//receive buffer, or the SDK's, and is only valid until the callback returns;
+//anything that must outlive it has to be copied, for which see retainWsView.
+struct WSView {
+  WSConnection *connection;
   uint8_t opcode;
-  uint8_t isMasked;
-  uint64_t payloadLength;
-  uint32_t maskingKey;
-  char* payloadData;
+  const char *data;        //not NUL terminated
+  uint32_t length;
+};
+
+//a copy of a message made by retainWsView, NUL terminated, which stays put
+//until releaseWsRetained.  Like a transmit buffer it lives in a pool block.
+struct WSRetained {
+  uint8_t opcode;
+  uint32_t length;
+  char *data;
+};
+
+//an encoded frame (or frames) waiting to be sent.  The data normally follows
+//the struct; for sendWsMessageNoCopy it is the caller's payload, which is
+//handed back through onSent.  A broadcast frame is shared by the queues of
+//all connections it goes to.
+struct WSTxBuffer {
+  uint16_t refCount;
+  uint8_t latestKey;       //set by sendWsLatest, 0 otherwise
+  uint32_t length;
+  uint8_t *data;
+  WSOnSent onSent;
+  void *sentContext;
+};
+
+//frame counts are indexed by opcode, in the order of WS_METRICS_OPCODES, and
+//byte counts are of payload.  The first three counters are only kept by
+//servers; a server's snapshot holds the sum of its connections, past and
+//present, with the longest handshake and deepest queue any of them saw.
+struct WSMetrics {
+  uint32_t accepted;            //tcp connections given a slot
+  uint32_t slotRejections;      //tcp connections turned away, every slot was taken
+  uint32_t handshakeRejections; //bad upgrade requests
+  uint32_t handshakeTime;       //microseconds from accepting the tcp connection to the upgrade response
+  uint32_t framesIn[WS_METRICS_OPCODES];
+  uint32_t bytesIn[WS_METRICS_OPCODES];
+  uint32_t framesOut[WS_METRICS_OPCODES];
+  uint32_t bytesOut[WS_METRICS_OPCODES];
+  uint32_t parseCycles;         //decoding and checking frame headers
+  uint32_t unmaskCycles;
+  uint32_t sentFailures;        //espconn_sent failures, retried unless the connection is broken
+  uint32_t superseded;          //sendWsLatest messages replaced before they went
+  uint8_t txQueueHighWater;     //most frames queued at once
+};
+
+struct WSTopic {
+  const char *name;         //the caller's string, which must stay put
+  uint8_t nameLength;
+  uint32_t *subscribers;    //WS_SUBSCRIBER_WORDS(maxConnections) words, a bit per connection slot
+};
+
+//state of the upgrade request parser, only used before the connection opens
+struct WSHandshake {
+  uint8_t state;
+  uint16_t flags;
+  uint8_t header;       //HS_HEADER_* of the value being read
+  uint8_t nameLength;
+  uint8_t valueLength;
+  char name[WS_HANDSHAKE_MAX_NAME];
+  char value[WS_HANDSHAKE_MAX_VALUE];
+  char key[WS_KEY_LENGTH + 1];
+  uint8_t deflateWindowBits; //0 unless a permessage-deflate offer was accepted
 };
 
 struct WSConnection {
+  WSServer *server;
   uint8_t status;
   struct espconn* connection;
+  uint8_t remoteIp[4];
+  int remotePort;
   WSOnMessage onMessage;
+  WSOnData onData;
+  WSOnView onView;
+  void *userContext;        //for onData
+  void *viewContext;        //for onView
+
+  WSHandshake handshake;
+  uint8_t deflateWindowBits; //0 unless permessage-deflate was negotiated
+
+  //incremental frame parser state
+  uint8_t rxState;
+  uint8_t rxHeaderLength;
+  uint8_t rxKeyOffset;
+  uint8_t rxHeader[WS_MAX_HEADER_LENGTH];
+  uint32_t rxPayloadReceived;
+  WSFrame rxFrame;
+
+  //message assembly
+  uint8_t rxMessageOpcode; //OPCODE_CONTINUE while no fragmented message is in progress
+  bool rxMessageCompressed; //RSV1 of the message's first fragment
+  uint32_t rxMessageLength;
+  char *rxBuffer;           //server->rxBufferSize + 1 bytes, +1 for the NUL terminator
+  char rxControl[WS_MAX_CONTROL_PAYLOAD + 1];
+
+  //transmit queue
+  WSTxBuffer **txQueue;    //server->txQueueDepth entries
+  uint8_t txHead;
+  uint8_t txCount;
+  WSTxBuffer *txInFlight; //handed to espconn_sent, freed by webSocketSentCb
+  uint32_t txOffset;      //bytes of txInFlight already sent
+  uint16_t txChunk;       //bytes of txInFlight currently with the SDK
+  WSConnection *txStalledNext;  //espconn_sent refused txChunk: in the server's
+  WSConnection **txStalledPrev; //list of chunks to offer again, NULL while not
+
+  //keepalive
+  WSConnection *timerNext;  //in the same timer wheel slot
+  WSConnection **timerPrev; //what points at us, NULL while no timer is set
+  uint32_t timerExpires;    //tick at which the timer fires
+  uint8_t pingsUnanswered;
+  uint32_t pingSentAt;      //system_get_time() of the latest ping, which is also its payload
+  uint32_t roundTripTime;   //in microseconds, of the latest answered ping
+
+#if WS_METRICS
+  WSMetrics metrics;        //folded into the server's when the connection goes
+  uint32_t acceptedAt;      //system_get_time() when the tcp connection was accepted
+#endif
 };
 
-void inline   webSocketDebug( const char* format ... ) {
-    char str[200];
-    
-    va_list args;
-    va_start(args, format);
-    
-    vsnprintf(str, sizeof(str), format, args);
-    Serial.print( str );
-    //    broadcastWsMessage(str, strlen(str), OPCODE_TEXT);
-    
-    va_end(args);
-}
+//a websocket server listening on one port.  The connection slots and their
+//buffers are provided by whoever creates it, normally a WebSocketServer<>.
+//A client is the same, with one slot and an outgoing connection in place of
+//the listening one.
+struct WSServer {
+  uint16_t port;
+  struct espconn listenConnection; //or, for a client, the outgoing connection
+  esp_tcp listenTcp;
+  WSServer *next; //servers that have begun, found by port when a connection arrives
+  bool isClient;
+  const char *host;         //client only, the caller's strings for the request
+  const char *path;
 
+  WSOnConnection onConnection;
+  WSOnMessage onMessage;
+  WSOnData onData;
+  WSOnView onView;
+  void *onDataContext;
+  void *onViewContext;
+  WSOnHighWater onHighWater;
+  WSOnOrigin onOrigin;
+  const char *protocol;
+
+  WSConnection *connections;
+  uint8_t maxConnections;
+  uint16_t rxBufferSize;   //largest message accepted
+  uint8_t txQueueDepth;
+  uint8_t txHighWater;
+  char *inflateBuffer;     //rxBufferSize + 1 bytes, shared by the connections
+
+  //keepalive timer wheel: each slot lists the connections whose timer falls
+  //due on a tick that maps to it
+  os_timer_t timer;
+  WSConnection *timerWheel[WS_TIMER_SLOTS];
+  uint32_t timerTick;
+  WSConnection *txStalled; //connections whose chunk the SDK refused, retried each tick
+
+  //topics by number, and a hash table of their numbers by name
+  WSTopic topics[WS_MAX_TOPICS];
+  uint8_t topicCount;
+  uint8_t topicIndex[WS_TOPIC_HASH_SLOTS]; //topic number + 1, 0 for an empty slot
+  uint8_t subscriberWords;  //length of each topic's subscribers, 0 if the server has no topics
+  bool subscriptionMessages; //clients may send WS_SUBSCRIBE and WS_UNSUBSCRIBE messages
+
+#if WS_METRICS
+  WSMetrics metrics;        //server counters plus those of closed connections
+#endif
+};
+
+#if WS_LOG_LEVEL > WS_LOG_NONE
+void ICACHE_FLASH_ATTR              logWs(WSLogSite *site, uint8_t level, const char *format, ...);
+void ICACHE_FLASH_ATTR              webSocketLogFlush( void );
+#else
+inline void                         webSocketLogFlush( void ) { }
+#endif
+void ICACHE_FLASH_ATTR              initWsServer(WSServer *server,
+                                                 uint16_t port,
+                                                 WSConnection *connections,
+                                                 uint8_t maxConnections,
+                                                 char *rxBuffers,
+                                                 uint16_t rxBufferSize,
+                                                 WSTxBuffer **txQueues,
+                                                 uint8_t txQueueDepth,
+                                                 char *inflateBuffer,
+                                                 uint32_t *subscribers);
+void ICACHE_FLASH_ATTR              beginWsServer(WSServer *server);
+sint8 ICACHE_FLASH_ATTR             connectWsClient(WSServer *client,
+                                                    const uint8_t ip[4],
+                                                    uint16_t port,
+                                                    const char *host,
+                                                    const char *path);
+void ICACHE_FLASH_ATTR              broadcastWsServer(WSServer *server,
+                                                      const char* payload,
+                                                      uint32_t payloadLength,
+                                                      uint8_t options);
+uint16_t ICACHE_FLASH_ATTR          countWsServerConnections(WSServer *server);
+int8_t ICACHE_FLASH_ATTR            addWsTopic(WSServer *server, const char *name);
+int8_t ICACHE_FLASH_ATTR            findWsTopic(WSServer *server, const char *name, uint8_t nameLength);
+void ICACHE_FLASH_ATTR              subscribeWsTopic(WSConnection *connection, int8_t topic);
+void ICACHE_FLASH_ATTR              unsubscribeWsTopic(WSConnection *connection, int8_t topic);
+void ICACHE_FLASH_ATTR              publishWsTopic(WSServer *server,
+                                                   int8_t topic,
+                                                   const char* payload,
+                                                   uint32_t payloadLength,
+                                                   uint8_t options);
 
 void ICACHE_FLASH_ATTR              webSocketInit( void );
-void ICACHE_FLASH_ATTR              sendWsMessage(WSConnection* connection,
+sint8 ICACHE_FLASH_ATTR             sendWsMessage(WSConnection* connection,
+                                                  const char* payload,
+                                                  uint32_t payloadLength,
+                                                  uint8_t options);
+sint8 ICACHE_FLASH_ATTR             sendWsMessageNoCopy(WSConnection* connection,
+                                                        const char* payload,
+                                                        uint32_t payloadLength,
+                                                        uint8_t options,
+                                                        WSOnSent onSent,
+                                                        void *context);
+sint8 ICACHE_FLASH_ATTR             sendWsLatest(WSConnection* connection,
+                                                 uint8_t key,
+                                                 const char* payload,
+                                                 uint32_t payloadLength,
+                                                 uint8_t options);
+sint8 ICACHE_FLASH_ATTR             beginWsBatch(WSBatch *batch, WSConnection* connection);
+sint8 ICACHE_FLASH_ATTR             appendWsBatch(WSBatch *batch,
                                                   const char* payload,
                                                   uint32_t payloadLength,
                                                   uint8_t options);
+sint8 ICACHE_FLASH_ATTR             flushWsBatch(WSBatch *batch);
+void ICACHE_FLASH_ATTR              abortWsBatch(WSBatch *batch);
 void ICACHE_FLASH_ATTR              broadcastWsMessage(const char* payload,
                                                        uint32_t payloadLength,
                                                        uint8_t options);
 uint16_t ICACHE_FLASH_ATTR          countWsConnections( void );
+int8_t ICACHE_FLASH_ATTR            webSocketAddTopic( const char *name );
+void ICACHE_FLASH_ATTR              publishWsMessage(int8_t topic,
+                                                     const char* payload,
+                                                     uint32_t payloadLength,
+                                                     uint8_t options);
 WSConnection *ICACHE_FLASH_ATTR     getWsConnection(struct espconn *connection);
-static int ICACHE_FLASH_ATTR        createWsAcceptKey(const char *key, char *buffer, int bufferSize);
-static void ICACHE_FLASH_ATTR       parseWsFrame(char *data, WSFrame *frame);
-static void ICACHE_FLASH_ATTR       unmaskWsPayload(char *maskedPayload,
-                                                    uint32_t payloadLength,
-                                                    uint32_t maskingKey);
+uint32_t ICACHE_FLASH_ATTR          getWsRoundTripTime(WSConnection *connection);
+bool ICACHE_FLASH_ATTR              getWsPoolStats(uint8_t pool, WSPoolStats *stats);
+WSRetained *ICACHE_FLASH_ATTR       retainWsView(const WSView *view);
+void ICACHE_FLASH_ATTR              releaseWsRetained(WSRetained *retained);
+#if WS_METRICS
+void ICACHE_FLASH_ATTR              getWsConnectionMetrics(WSConnection *connection, WSMetrics *snapshot);
+void ICACHE_FLASH_ATTR              getWsServerMetrics(WSServer *server, WSMetrics *snapshot);
+void ICACHE_FLASH_ATTR              getWsMetrics(WSMetrics *snapshot);
+int ICACHE_FLASH_ATTR               formatWsMetricsJson(const WSMetrics *metrics, char *buffer, int bufferSize);
+#endif
 void                                closeWsConnection(WSConnection* connection);
 
 void                                webSocketSetReceiveCallback( void (*onMessage)(char *paylodData) );
+void                                webSocketSetDataCallback( WSOnData onData, void *userContext );
+void                                webSocketSetViewCallback( WSOnView onView, void *userContext );
+void                                webSocketSetHighWaterCallback( WSOnHighWater onHighWater );
+void                                webSocketSetOriginCallback( WSOnOrigin onOrigin );
+void                                webSocketSetProtocol( const char *protocol );
+void                                webSocketSetSubscriptionMessages( bool enabled );
 void                                   webSocketSetConnectionCallback( void (*onConnection)(void) );
 
 void                                webSocketConnectCb(void *arg);
@@ -120,5 +576,118 @@ void                                webSocketRecvCb(void *arg, char *pusrdata, u
 void                                webSocketSentCb(void *arg);
 void                                webSocketDisconCb(void *arg);
 void                                webSocketReconCb(void *arg, sint8 err);
+void                                webSocketTimerCb(void *arg);
+void                                webSocketClientConnectCb(void *arg);
+
+//***********************************************************************
+// A server with its connection slots and buffers sized at compile time, so
+// several can listen on different ports and the RAM each takes is known
+// exactly.  The plain webSocket* functions work on a default instance sized
+// by WS_MAXCONN, WS_MAX_MESSAGE_SIZE and WS_TX_QUEUE_DEPTH, made the first
+// time one of them is called.
+//
+//   static WebSocketServer<2, 512, 4> telemetry(8080);
+//   telemetry.setDataCallback(onData, NULL);
+//   telemetry.begin();
+template <uint8_t MaxConn, uint16_t RxBufSize, uint8_t TxQueueDepth>
+class WebSocketServer : public WSServer {
+public:
+  //everything the server owns: the slots, their buffers and queues, and
+  //the shared inflate buffer
+  static const uint32_t ramSize = sizeof(WSServer) +
+                                  MaxConn * (sizeof(WSConnection) + RxBufSize + 1 + TxQueueDepth * sizeof(WSTxBuffer *)) +
+                                  WS_MAX_TOPICS * WS_SUBSCRIBER_WORDS(MaxConn) * sizeof(uint32_t) +
+                                  (WS_DEFLATE ? RxBufSize + 1 : 0);
+
+  static_assert(MaxConn > 0, "a WebSocketServer needs at least one connection");
+  static_assert(TxQueueDepth >= 2, "sendWsMessageNoCopy queues two buffers per message");
+  static_assert(ramSize <= WS_RAM_BUDGET, "WebSocketServer is bigger than WS_RAM_BUDGET");
+
+  explicit WebSocketServer(uint16_t port = WEB_SOCKET_PORT) {
+    initWsServer(this, port, slots, MaxConn, rxBuffers[0], RxBufSize, txQueues[0], TxQueueDepth,
+                 WS_DEFLATE ? inflateStorage : NULL, subscriberStorage[0]);
+  }
+
+  void begin( void ) { beginWsServer(this); }
+  void setReceiveCallback( WSOnMessage callback ) { onMessage = callback; }
+  void setDataCallback( WSOnData callback, void *userContext ) { onData = callback; onDataContext = userContext; }
+  void setViewCallback( WSOnView callback, void *userContext ) { onView = callback; onViewContext = userContext; }
+  void setHighWaterCallback( WSOnHighWater callback ) { onHighWater = callback; }
+  void setOriginCallback( WSOnOrigin callback ) { onOrigin = callback; }
+  void setProtocol( const char *name ) { protocol = name; }
+  void setSubscriptionMessages( bool enabled ) { subscriptionMessages = enabled; }
+  void setConnectionCallback( WSOnConnection callback ) { onConnection = callback; }
+  void broadcast(const char *payload, uint32_t payloadLength, uint8_t options) {
+    broadcastWsServer(this, payload, payloadLength, options);
+  }
+  uint16_t countConnections( void ) { return countWsServerConnections(this); }
+  int8_t addTopic( const char *name ) { return addWsTopic(this, name); }
+  void publish(int8_t topic, const char *payload, uint32_t payloadLength, uint8_t options) {
+    publishWsTopic(this, topic, payload, payloadLength, options);
+  }
+#if WS_METRICS
+  void getMetrics(WSMetrics *snapshot) { getWsServerMetrics(this, snapshot); }
+#endif
+
+private:
+  //the SDK and the connections point back at the server, so it can't be copied
+  WebSocketServer(const WebSocketServer &) = delete;
+  WebSocketServer &operator=(const WebSocketServer &) = delete;
+
+  WSConnection slots[MaxConn];
+  char rxBuffers[MaxConn][RxBufSize + 1];
+  WSTxBuffer *txQueues[MaxConn][TxQueueDepth];
+  uint32_t subscriberStorage[WS_MAX_TOPICS][WS_SUBSCRIBER_WORDS(MaxConn)];
+  char inflateStorage[WS_DEFLATE ? RxBufSize + 1 : 1];
+};
+
+//***********************************************************************
+// A client, connecting out to a websocket server.  It shares the frame
+// parser, send paths and keepalive with the servers; its frames are masked
+// and it doesn't negotiate permessage-deflate.
+//
+//   static WebSocketClient<512, 4> upstream;
+//   static const uint8_t collector[4] = { 192, 168, 1, 10 };
+//   upstream.setDataCallback(onData, NULL);
+//   upstream.connect(collector, 8080, "192.168.1.10", "/ingest");
+template <uint16_t RxBufSize, uint8_t TxQueueDepth>
+class WebSocketClient : public WSServer {
+public:
+  static_assert(TxQueueDepth >= 2, "sendWsMessageNoCopy queues two buffers per message");
+
+  WebSocketClient() {
+    initWsServer(this, 0, &slot, 1, rxBuffer, RxBufSize, txQueue, TxQueueDepth, NULL, NULL);
+    isClient = true;
+  }
+
+  //host and path must stay put until the connection has opened
+  sint8 connect(const uint8_t ip[4], uint16_t port, const char *host, const char *path) {
+    return connectWsClient(this, ip, port, host, path);
+  }
+  bool isOpen( void ) { return slot.connection != NULL && slot.status == STATUS_OPEN; }
+  sint8 send(const char *payload, uint32_t payloadLength, uint8_t options) {
+    return sendWsMessage(&slot, payload, payloadLength, options);
+  }
+  void close( void ) {
+    if (slot.connection != NULL) {
+      closeWsConnection(&slot);
+    }
+  }
+  WSConnection *connection( void ) { return &slot; }
+  void setReceiveCallback( WSOnMessage callback ) { onMessage = callback; }
+  void setDataCallback( WSOnData callback, void *userContext ) { onData = callback; onDataContext = userContext; }
+  void setViewCallback( WSOnView callback, void *userContext ) { onView = callback; onViewContext = userContext; }
+  void setHighWaterCallback( WSOnHighWater callback ) { onHighWater = callback; }
+  void setProtocol( const char *name ) { protocol = name; }
+  void setConnectionCallback( WSOnConnection callback ) { onConnection = callback; }
+
+private:
+  WebSocketClient(const WebSocketClient &) = delete;
+  WebSocketClient &operator=(const WebSocketClient &) = delete;
+
+  WSConnection slot;
+  char rxBuffer[RxBufSize + 1];
+  WSTxBuffer *txQueue[TxQueueDepth];
+};
 
 #endif //_MESH_WEB_SOCKET_H_
@@ -35,6 +35,7 @@ uint32_t sha1_rol32(uint32_t number, uint8_t bits) {
   return ((number << bits) | (number >> (32-bits)));
 }
 
+#ifdef SHA1_SMALL
 void sha1_hashBlock(sha1nfo *s) {
   uint8_t i;
   uint32_t a,b,c,d,e,t;
@@ -71,6 +72,56 @@ void sha1_hashBlock(sha1nfo *s) {
   s->state[3] += d;
   s->state[4] += e;
 }
+#else
+// Fully unrolled compression.  The five working variables rotate through
+// the macro arguments instead of being shuffled every round, and each group
+// of 20 rounds uses its own round function, so there is no per round branch.
+// Define SHA1_SMALL for the compact loop above if flash is tight.
+#define SHA1_ROL(v,n) (((v) << (n)) | ((v) >> (32-(n))))
+#define SHA1_W(i) (s->buffer[(i)&15] = SHA1_ROL(s->buffer[((i)+13)&15] ^ s->buffer[((i)+8)&15] ^ s->buffer[((i)+2)&15] ^ s->buffer[(i)&15], 1))
+#define SHA1_R0(v,w,x,y,z,i) z += ((w & (x ^ y)) ^ y) + s->buffer[i] + SHA1_K0 + SHA1_ROL(v,5); w = SHA1_ROL(w,30);
+#define SHA1_R1(v,w,x,y,z,i) z += ((w & (x ^ y)) ^ y) + SHA1_W(i) + SHA1_K0 + SHA1_ROL(v,5); w = SHA1_ROL(w,30);
+#define SHA1_R2(v,w,x,y,z,i) z += (w ^ x ^ y) + SHA1_W(i) + SHA1_K20 + SHA1_ROL(v,5); w = SHA1_ROL(w,30);
+#define SHA1_R3(v,w,x,y,z,i) z += (((w | x) & y) | (w & x)) + SHA1_W(i) + SHA1_K40 + SHA1_ROL(v,5); w = SHA1_ROL(w,30);
+#define SHA1_R4(v,w,x,y,z,i) z += (w ^ x ^ y) + SHA1_W(i) + SHA1_K60 + SHA1_ROL(v,5); w = SHA1_ROL(w,30);
+
+void sha1_hashBlock(sha1nfo *s) {
+  uint32_t a,b,c,d,e;
+
+  a=s->state[0];
+  b=s->state[1];
+  c=s->state[2];
+  d=s->state[3];
+  e=s->state[4];
+
+  SHA1_R0(a,b,c,d,e, 0); SHA1_R0(e,a,b,c,d, 1); SHA1_R0(d,e,a,b,c, 2); SHA1_R0(c,d,e,a,b, 3);
+  SHA1_R0(b,c,d,e,a, 4); SHA1_R0(a,b,c,d,e, 5); SHA1_R0(e,a,b,c,d, 6); SHA1_R0(d,e,a,b,c, 7);
+  SHA1_R0(c,d,e,a,b, 8); SHA1_R0(b,c,d,e,a, 9); SHA1_R0(a,b,c,d,e,10); SHA1_R0(e,a,b,c,d,11);
+  SHA1_R0(d,e,a,b,c,12); SHA1_R0(c,d,e,a,b,13); SHA1_R0(b,c,d,e,a,14); SHA1_R0(a,b,c,d,e,15);
+  SHA1_R1(e,a,b,c,d,16); SHA1_R1(d,e,a,b,c,17); SHA1_R1(c,d,e,a,b,18); SHA1_R1(b,c,d,e,a,19);
+  SHA1_R2(a,b,c,d,e,20); SHA1_R2(e,a,b,c,d,21); SHA1_R2(d,e,a,b,c,22); SHA1_R2(c,d,e,a,b,23);
+  SHA1_R2(b,c,d,e,a,24); SHA1_R2(a,b,c,d,e,25); SHA1_R2(e,a,b,c,d,26); SHA1_R2(d,e,a,b,c,27);
+  SHA1_R2(c,d,e,a,b,28); SHA1_R2(b,c,d,e,a,29); SHA1_R2(a,b,c,d,e,30); SHA1_R2(e,a,b,c,d,31);
+  SHA1_R2(d,e,a,b,c,32); SHA1_R2(c,d,e,a,b,33); SHA1_R2(b,c,d,e,a,34); SHA1_R2(a,b,c,d,e,35);
+  SHA1_R2(e,a,b,c,d,36); SHA1_R2(d,e,a,b,c,37); SHA1_R2(c,d,e,a,b,38); SHA1_R2(b,c,d,e,a,39);
+  SHA1_R3(a,b,c,d,e,40); SHA1_R3(e,a,b,c,d,41); SHA1_R3(d,e,a,b,c,42); SHA1_R3(c,d,e,a,b,43);
+  SHA1_R3(b,c,d,e,a,44); SHA1_R3(a,b,c,d,e,45); SHA1_R3(e,a,b,c,d,46); SHA1_R3(d,e,a,b,c,47);
+  SHA1_R3(c,d,e,a,b,48); SHA1_R3(b,c,d,e,a,49); SHA1_R3(a,b,c,d,e,50); SHA1_R3(e,a,b,c,d,51);
+  SHA1_R3(d,e,a,b,c,52); SHA1_R3(c,d,e,a,b,53); SHA1_R3(b,c,d,e,a,54); SHA1_R3(a,b,c,d,e,55);
+  SHA1_R3(e,a,b,c,d,56); SHA1_R3(d,e,a,b,c,57); SHA1_R3(c,d,e,a,b,58); SHA1_R3(b,c,d,e,a,59);
+  SHA1_R4(a,b,c,d,e,60); SHA1_R4(e,a,b,c,d,61); SHA1_R4(d,e,a,b,c,62); SHA1_R4(c,d,e,a,b,63);
+  SHA1_R4(b,c,d,e,a,64); SHA1_R4(a,b,c,d,e,65); SHA1_R4(e,a,b,c,d,66); SHA1_R4(d,e,a,b,c,67);
+  SHA1_R4(c,d,e,a,b,68); SHA1_R4(b,c,d,e,a,69); SHA1_R4(a,b,c,d,e,70); SHA1_R4(e,a,b,c,d,71);
+  SHA1_R4(d,e,a,b,c,72); SHA1_R4(c,d,e,a,b,73); SHA1_R4(b,c,d,e,a,74); SHA1_R4(a,b,c,d,e,75);
+  SHA1_R4(e,a,b,c,d,76); SHA1_R4(d,e,a,b,c,77); SHA1_R4(c,d,e,a,b,78); SHA1_R4(b,c,d,e,a,79);
+
+  s->state[0] += a;
+  s->state[1] += b;
+  s->state[2] += c;
+  s->state[3] += d;
+  s->state[4] += e;
+}
+#endif
 
 void sha1_addUncounted(sha1nfo *s, uint8_t data) {
   uint8_t * const b = (uint8_t*) s->buffer;
@@ -91,8 +142,25 @@ void sha1_writebyte(sha1nfo *s, uint8_t data) {
   sha1_addUncounted(s, data);
 }
 
+// Whole blocks are loaded straight into the message words, a big endian
+// word at a time; only a partial block at either end goes through the byte
+// wise buffer.
 void sha1_write(sha1nfo *s, const char *data, size_t len) {
-  for (;len--;) sha1_writebyte(s, (uint8_t) *data++);
+  const uint8_t *p = (const uint8_t *) data;
+  uint8_t i;
+
+  s->byteCount += len;
+
+  for (; len && s->bufferOffset; len--) sha1_addUncounted(s, *p++);
+
+  for (; len >= BLOCK_LENGTH; len -= BLOCK_LENGTH) {
+    for (i=0; i<BLOCK_LENGTH/4; i++, p+=4) {
+      s->buffer[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    sha1_hashBlock(s);
+  }
+
+  for (; len--;) sha1_addUncounted(s, *p++);
 }
 
 void sha1_pad(sha1nfo *s) {
@@ -138,11 +206,12 @@ uint8_t* sha1_result(sha1nfo *s) {
 
 void sha1_initHmac(sha1nfo *s, const uint8_t* key, int keyLength) {
   uint8_t i;
+  uint8_t pad[BLOCK_LENGTH];
   memset(s->keyBuffer, 0, BLOCK_LENGTH);
   if (keyLength > BLOCK_LENGTH) {
     // Hash long keys
     sha1_init(s);
-    for (;keyLength--;) sha1_writebyte(s, *key++);
+    sha1_write(s, (const char *) key, keyLength);
     memcpy(s->keyBuffer, sha1_result(s), HASH_LENGTH);
   } else {
     // Block length keys are used as is
@@ -150,19 +219,20 @@ void sha1_initHmac(sha1nfo *s, const uint8_t* key, int keyLength) {
   }
   // Start inner hash
   sha1_init(s);
-  for (i=0; i<BLOCK_LENGTH; i++) {
-    sha1_writebyte(s, s->keyBuffer[i] ^ HMAC_IPAD);
-  }
+  for (i=0; i<BLOCK_LENGTH; i++) pad[i] = s->keyBuffer[i] ^ HMAC_IPAD;
+  sha1_write(s, (const char *) pad, BLOCK_LENGTH);
 }
 
 uint8_t* sha1_resultHmac(sha1nfo *s) {
   uint8_t i;
+  uint8_t pad[BLOCK_LENGTH];
   // Complete inner hash
   memcpy(s->innerHash,sha1_result(s),HASH_LENGTH);
   // Calculate outer hash
   sha1_init(s);
-  for (i=0; i<BLOCK_LENGTH; i++) sha1_writebyte(s, s->keyBuffer[i] ^ HMAC_OPAD);
-  for (i=0; i<HASH_LENGTH; i++) sha1_writebyte(s, s->innerHash[i]);
+  for (i=0; i<BLOCK_LENGTH; i++) pad[i] = s->keyBuffer[i] ^ HMAC_OPAD;
+  sha1_write(s, (const char *) pad, BLOCK_LENGTH);
+  sha1_write(s, (const char *) s->innerHash, HASH_LENGTH);
   return sha1_result(s);
 }
 
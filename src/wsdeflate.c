@@ -0,0 +1,513 @@
+/* wsdeflate.c : DEFLATE for the permessage-deflate extension */
+/* Both directions work on one whole message at a time, which is all that
+ * is needed with no_context_takeover: every message starts with an empty
+ * window, so the message itself is the only history a match can refer to.
+ *
+ * A message is sent as it would be by zlib with Z_SYNC_FLUSH: compressed
+ * blocks followed by an empty stored block whose final 4 bytes (00 00 ff ff)
+ * are left off (RFC 7692 section 7.2.1).  The receiver puts them back before
+ * inflating.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wsdeflate.h"
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 16 /* candidates looked at per position */
+
+#define END_OF_BLOCK 256
+
+/* RFC 1951 section 3.2.5 */
+static const uint16_t lengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* order of the code length code lengths in a dynamic block header */
+static const uint8_t codeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* the appended end of a sync flush */
+static const uint8_t syncTrailer[4] = { 0x00, 0x00, 0xff, 0xff };
+
+/*************************************************************************
+ * compression
+ */
+
+typedef struct {
+  uint8_t *out;
+  uint8_t *end;
+  uint32_t bits;
+  uint8_t count;
+  uint8_t overflow;
+} BitWriter;
+
+/* bits are packed starting at the least significant bit of each byte */
+static void putBits(BitWriter *w, uint32_t value, uint8_t n) {
+  w->bits |= value << w->count;
+  w->count += n;
+  while (w->count >= 8) {
+    if (w->out < w->end) {
+      *w->out++ = (uint8_t)w->bits;
+    } else {
+      w->overflow = 1;
+    }
+    w->bits >>= 8;
+    w->count -= 8;
+  }
+}
+
+static uint8_t reverse8(uint8_t b) {
+  static const uint8_t nibble[16] = {
+    0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+  };
+  return (nibble[b & 0xf] << 4) | nibble[b >> 4];
+}
+
+/* Huffman codes go out most significant bit first, so they are reversed to
+ * suit putBits.  Fixed literal/length codes (RFC 1951 section 3.2.6) */
+static void putSymbol(BitWriter *w, uint16_t symbol) {
+  if (symbol < 144) {
+    putBits(w, reverse8(0x30 + symbol), 8);
+  } else if (symbol < 256) {
+    uint16_t code = 0x190 + symbol - 144;
+    putBits(w, (reverse8(code & 0xff) << 1) | (code >> 8), 9);
+  } else if (symbol < 280) {
+    putBits(w, reverse8(symbol - 256) >> 1, 7);
+  } else {
+    putBits(w, reverse8(0xc0 + symbol - 280), 8);
+  }
+}
+
+static void putMatch(BitWriter *w, uint16_t length, uint16_t distance) {
+  uint8_t code = 28;
+  while (lengthBase[code] > length) {
+    code--;
+  }
+  putSymbol(w, 257 + code);
+  putBits(w, length - lengthBase[code], lengthExtra[code]);
+
+  code = 29;
+  while (distBase[code] > distance) {
+    code--;
+  }
+  putBits(w, reverse8(code) >> 3, 5);
+  putBits(w, distance - distBase[code], distExtra[code]);
+}
+
+static uint32_t hash3(const uint8_t *p, uint8_t hashBits) {
+  uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+  return (v * 2654435761u) >> (32 - hashBits);
+}
+
+/* Compresses in as one fixed Huffman block with greedy LZ77 matching over
+ * a 2^windowBits byte window (8 to 15).  Each hash chain is followed for
+ * at most MAX_CHAIN candidates.  work must hold
+ * WSDEFLATE_WORK_WORDS(windowBits, memLevel) words.  Returns the compressed
+ * length, or -1 if it would be more than outSize bytes or in is longer
+ * than WSDEFLATE_MAX_INPUT, in which case the message should be sent as it
+ * is. */
+int32_t wsdeflate_compress(const uint8_t *in, uint32_t inLength,
+                           uint8_t *out, uint32_t outSize,
+                           uint8_t windowBits, uint8_t memLevel, uint16_t *work) {
+  uint8_t hashBits = memLevel + 7;
+  uint32_t windowSize = 1UL << windowBits;
+  uint32_t windowMask = windowSize - 1;
+  uint16_t *prev = work;                /* previous position+1 with the same hash */
+  uint16_t *head = work + windowSize;   /* latest position+1 for each hash */
+  uint32_t pos = 0;
+  BitWriter w;
+
+  if (inLength > WSDEFLATE_MAX_INPUT) {
+    return -1;
+  }
+
+  memset(head, 0, sizeof(uint16_t) << hashBits);
+  w.out = out;
+  w.end = out + outSize;
+  w.bits = 0;
+  w.count = 0;
+  w.overflow = 0;
+
+  putBits(&w, 0, 1); /* BFINAL clear */
+  putBits(&w, 1, 2); /* BTYPE fixed Huffman */
+
+  while (pos < inLength && !w.overflow) {
+    uint32_t bestLength = 0;
+    uint32_t bestDistance = 0;
+
+    if (pos + MIN_MATCH <= inLength) {
+      uint32_t maxLength = inLength - pos;
+      uint32_t h = hash3(in + pos, hashBits);
+      uint32_t candidate = head[h];
+      uint8_t chain = MAX_CHAIN;
+
+      if (maxLength > MAX_MATCH) {
+        maxLength = MAX_MATCH;
+      }
+
+      while (candidate != 0 && chain-- > 0) {
+        uint32_t match = candidate - 1;
+        if (pos - match > windowSize) {
+          break;
+        }
+        /* the byte that would improve on the best match is checked first */
+        if (in[match + bestLength] == in[pos + bestLength]) {
+          uint32_t length = 0;
+          while (length < maxLength && in[match + length] == in[pos + length]) {
+            length++;
+          }
+          if (length > bestLength) {
+            bestLength = length;
+            bestDistance = pos - match;
+            if (length == maxLength) {
+              break;
+            }
+          }
+        }
+        uint32_t next = prev[match & windowMask];
+        if (next >= candidate) {
+          break; /* the slot has been reused by a newer position */
+        }
+        candidate = next;
+      }
+
+      prev[pos & windowMask] = head[h];
+      head[h] = pos + 1;
+    }
+
+    if (bestLength >= MIN_MATCH) {
+      putMatch(&w, bestLength, bestDistance);
+      /* the positions inside the match go into the history too */
+      uint32_t end = pos + bestLength;
+      for (pos++; pos < end; pos++) {
+        if (pos + MIN_MATCH <= inLength) {
+          uint32_t h = hash3(in + pos, hashBits);
+          prev[pos & windowMask] = head[h];
+          head[h] = pos + 1;
+        }
+      }
+    } else {
+      putSymbol(&w, in[pos]);
+      pos++;
+    }
+  }
+
+  putSymbol(&w, END_OF_BLOCK);
+  putBits(&w, 0, 3); /* an empty stored block, not final ... */
+  if (w.count > 0) {
+    putBits(&w, 0, 8 - w.count); /* ... whose LEN and NLEN are left off */
+  }
+
+  if (w.overflow) {
+    return -1;
+  }
+  return w.out - out;
+}
+
+/*************************************************************************
+ * decompression
+ */
+
+/* canonical Huffman decoding tables, as in zlib's puff: the number of codes
+ * of each length, and the symbols ordered by code */
+typedef struct {
+  uint16_t counts[16];
+  uint16_t *symbols;
+} Huffman;
+
+/* Decoder state.  It is too big for the stack of an SDK callback, so there
+ * is one copy, and wsdeflate_inflate is not reentrant. */
+static struct {
+  const uint8_t *in;
+  const uint8_t *end;
+  uint8_t trailer;  /* bytes of syncTrailer read once in is used up */
+  uint8_t error;
+  uint32_t bits;
+  uint8_t count;
+  uint16_t litSymbols[288];
+  uint16_t distSymbols[30];
+  uint8_t lengths[286 + 30];
+} wsInflate;
+
+static uint8_t getByte(void) {
+  if (wsInflate.in < wsInflate.end) {
+    return *wsInflate.in++;
+  }
+  if (wsInflate.trailer < sizeof(syncTrailer)) {
+    return syncTrailer[wsInflate.trailer++];
+  }
+  wsInflate.error = 1;
+  return 0;
+}
+
+static uint32_t getBits(uint8_t n) {
+  uint32_t value;
+  while (wsInflate.count < n) {
+    wsInflate.bits |= (uint32_t)getByte() << wsInflate.count;
+    wsInflate.count += 8;
+  }
+  value = wsInflate.bits & ((1UL << n) - 1);
+  wsInflate.bits >>= n;
+  wsInflate.count -= n;
+  return value;
+}
+
+/* returns -1 for an over-subscribed set of lengths.  Incomplete codes are
+ * allowed, using one of the missing codes is caught by decodeSymbol */
+static int buildHuffman(Huffman *h, const uint8_t *lengths, uint16_t n) {
+  uint16_t offsets[16];
+  int32_t left = 1;
+  uint16_t i;
+
+  memset(h->counts, 0, sizeof(h->counts));
+  for (i = 0; i < n; i++) {
+    h->counts[lengths[i]]++;
+  }
+  h->counts[0] = 0;
+
+  for (i = 1; i < 16; i++) {
+    left = (left << 1) - h->counts[i];
+    if (left < 0) {
+      return -1;
+    }
+  }
+
+  offsets[1] = 0;
+  for (i = 1; i < 15; i++) {
+    offsets[i + 1] = offsets[i] + h->counts[i];
+  }
+  for (i = 0; i < n; i++) {
+    if (lengths[i] != 0) {
+      h->symbols[offsets[lengths[i]]++] = i;
+    }
+  }
+  return 0;
+}
+
+static int decodeSymbol(const Huffman *h) {
+  int32_t code = 0;
+  int32_t first = 0;
+  int32_t index = 0;
+  uint8_t length;
+
+  for (length = 1; length < 16; length++) {
+    code |= getBits(1);
+    int32_t count = h->counts[length];
+    if (code - first < count) {
+      return h->symbols[index + code - first];
+    }
+    index += count;
+    first = (first + count) << 1;
+    code <<= 1;
+  }
+  wsInflate.error = 1;
+  return -1;
+}
+
+/* inflates one block's worth of codes into out, which is written from
+ * start and ends at end */
+static int inflateCodes(const Huffman *lit, const Huffman *dist,
+                        uint8_t *start, uint8_t **out, uint8_t *end) {
+  uint8_t *o = *out;
+
+  for (;;) {
+    int symbol = decodeSymbol(lit);
+    if (wsInflate.error) {
+      return -1;
+    }
+
+    if (symbol < 256) {
+      if (o == end) {
+        return -1;
+      }
+      *o++ = symbol;
+    } else if (symbol == END_OF_BLOCK) {
+      break;
+    } else {
+      symbol -= 257;
+      if (symbol >= 29) {
+        return -1;
+      }
+      uint32_t length = lengthBase[symbol] + getBits(lengthExtra[symbol]);
+
+      symbol = decodeSymbol(dist);
+      if (wsInflate.error || symbol >= 30) {
+        return -1;
+      }
+      uint32_t distance = distBase[symbol] + getBits(distExtra[symbol]);
+
+      if (distance > (uint32_t)(o - start) || length > (uint32_t)(end - o)) {
+        return -1;
+      }
+      const uint8_t *from = o - distance;
+      while (length-- > 0) {
+        *o++ = *from++;  /* byte wise, the copy may overlap itself */
+      }
+    }
+  }
+
+  *out = o;
+  return wsInflate.error ? -1 : 0;
+}
+
+static int inflateStored(uint8_t **out, uint8_t *end) {
+  uint8_t *o = *out;
+  uint16_t length;
+  uint16_t check;
+
+  /* a stored block starts on a byte boundary */
+  wsInflate.bits = 0;
+  wsInflate.count = 0;
+
+  length = getByte();
+  length |= (uint16_t)getByte() << 8;
+  check = getByte();
+  check |= (uint16_t)getByte() << 8;
+  if (wsInflate.error || (length ^ check) != 0xFFFF || length > end - o) {
+    return -1;
+  }
+
+  while (length-- > 0) {
+    *o++ = getByte();
+  }
+
+  *out = o;
+  return wsInflate.error ? -1 : 0;
+}
+
+static int inflateFixed(uint8_t *start, uint8_t **out, uint8_t *end) {
+  Huffman lit = { {0}, wsInflate.litSymbols };
+  Huffman dist = { {0}, wsInflate.distSymbols };
+  uint16_t i;
+
+  for (i = 0; i < 144; i++) wsInflate.lengths[i] = 8;
+  for (; i < 256; i++) wsInflate.lengths[i] = 9;
+  for (; i < 280; i++) wsInflate.lengths[i] = 7;
+  for (; i < 288; i++) wsInflate.lengths[i] = 8;
+  buildHuffman(&lit, wsInflate.lengths, 288);
+
+  for (i = 0; i < 30; i++) wsInflate.lengths[i] = 5;
+  buildHuffman(&dist, wsInflate.lengths, 30);
+
+  return inflateCodes(&lit, &dist, start, out, end);
+}
+
+static int inflateDynamic(uint8_t *start, uint8_t **out, uint8_t *end) {
+  Huffman lit = { {0}, wsInflate.litSymbols };
+  Huffman dist = { {0}, wsInflate.distSymbols };
+  uint16_t nlen = getBits(5) + 257;
+  uint16_t ndist = getBits(5) + 1;
+  uint16_t ncode = getBits(4) + 4;
+  uint16_t i;
+
+  if (nlen > 286 || ndist > 30) {
+    return -1;
+  }
+
+  /* the code length code is built in the distance table, it is done with
+   * before the distance code is */
+  memset(wsInflate.lengths, 0, 19);
+  for (i = 0; i < ncode; i++) {
+    wsInflate.lengths[codeLengthOrder[i]] = getBits(3);
+  }
+  if (buildHuffman(&dist, wsInflate.lengths, 19) != 0) {
+    return -1;
+  }
+
+  for (i = 0; i < nlen + ndist;) {
+    int symbol = decodeSymbol(&dist);
+    uint8_t value = 0;
+    uint8_t repeat;
+
+    if (wsInflate.error) {
+      return -1;
+    }
+    if (symbol < 16) {
+      wsInflate.lengths[i++] = symbol;
+      continue;
+    }
+    if (symbol == 16) {
+      if (i == 0) {
+        return -1;
+      }
+      value = wsInflate.lengths[i - 1];
+      repeat = 3 + getBits(2);
+    } else if (symbol == 17) {
+      repeat = 3 + getBits(3);
+    } else {
+      repeat = 11 + getBits(7);
+    }
+    if (i + repeat > nlen + ndist) {
+      return -1;
+    }
+    while (repeat-- > 0) {
+      wsInflate.lengths[i++] = value;
+    }
+  }
+
+  if (wsInflate.lengths[END_OF_BLOCK] == 0 ||
+      buildHuffman(&lit, wsInflate.lengths, nlen) != 0 ||
+      buildHuffman(&dist, wsInflate.lengths + nlen, ndist) != 0) {
+    return -1;
+  }
+
+  return inflateCodes(&lit, &dist, start, out, end);
+}
+
+/* Inflates one received message into out.  The sync flush trailer is
+ * supplied here, the sender leaves it off.  Returns the inflated length, or
+ * -1 if the data is invalid or inflates to more than outSize bytes. */
+int32_t wsdeflate_inflate(const uint8_t *in, uint32_t inLength,
+                          uint8_t *out, uint32_t outSize) {
+  uint8_t *o = out;
+  uint8_t *end = out + outSize;
+  uint8_t last;
+
+  wsInflate.in = in;
+  wsInflate.end = in + inLength;
+  wsInflate.trailer = 0;
+  wsInflate.error = 0;
+  wsInflate.bits = 0;
+  wsInflate.count = 0;
+
+  do {
+    int result;
+    last = getBits(1);
+    switch (getBits(2)) {
+      case 0:
+        result = inflateStored(&o, end);
+        break;
+      case 1:
+        result = inflateFixed(out, &o, end);
+        break;
+      case 2:
+        result = inflateDynamic(out, &o, end);
+        break;
+      default:
+        result = -1;
+        break;
+    }
+    if (result != 0 || wsInflate.error) {
+      return -1;
+    }
+    /* a message normally ends with the empty stored block of the trailer */
+  } while (!last && (wsInflate.in < wsInflate.end || wsInflate.trailer < sizeof(syncTrailer)));
+
+  return o - out;
+}
@@ -0,0 +1,31 @@
+// permessage-deflate (RFC 7692) payload codec: a raw DEFLATE (RFC 1951)
+// compressor using the fixed Huffman codes, and a decompressor for all
+// block types
+
+#ifndef _WS_DEFLATE_H_
+#define _WS_DEFLATE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* longest input wsdeflate_compress accepts; positions are kept in 16 bits */
+#define WSDEFLATE_MAX_INPUT 0xFFFF
+
+/* size, in uint16_t, of the work area wsdeflate_compress needs: the match
+ * history for a 2^windowBits window plus a 2^(memLevel+7) entry hash table */
+#define WSDEFLATE_WORK_WORDS(windowBits, memLevel) ((1UL << (windowBits)) + (1UL << ((memLevel) + 7)))
+
+int32_t   wsdeflate_compress(const uint8_t *in, uint32_t inLength,
+                             uint8_t *out, uint32_t outSize,
+                             uint8_t windowBits, uint8_t memLevel, uint16_t *work);
+int32_t   wsdeflate_inflate(const uint8_t *in, uint32_t inLength,
+                            uint8_t *out, uint32_t outSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WS_DEFLATE_H_
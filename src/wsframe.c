@@ -0,0 +1,81 @@
+/* wsframe.c : websocket frame header encode/decode */
+/* Lengths are converted to and from network (big endian) byte order a byte
+ * at a time, so the code is the same on little and big endian cpus.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wsframe.h"
+
+/* extra header bytes for the 7 bit payload length field, 126 and 127 select
+ * the 16 and 64 bit extended lengths */
+#define EXTENDED_LENGTH_BYTES(len7) ((len7) < 126 ? 0 : (len7) == 126 ? 2 : 8)
+
+/* number of header bytes of the frame whose first two bytes are at header */
+uint8_t wsframe_headerLength(const uint8_t *header) {
+  uint8_t len7 = header[1] & PAYLOAD_MASK;
+  return 2 + EXTENDED_LENGTH_BYTES(len7) + ((header[1] & IS_MASKED) ? 4 : 0);
+}
+
+/* decode a complete header, returns its length */
+uint8_t wsframe_decodeHeader(const uint8_t *header, WSFrame *frame) {
+  uint8_t len7 = header[1] & PAYLOAD_MASK;
+  const uint8_t *p = header + 2;
+  uint64_t length = len7;
+
+  frame->flags = header[0] & FLAGS_MASK;
+  frame->opcode = header[0] & OPCODE_MASK;
+  frame->isMasked = header[1] & IS_MASKED;
+
+  if (len7 == 126) {
+    length = ((uint32_t)p[0] << 8) | p[1];
+    p += 2;
+  } else if (len7 == 127) {
+    uint32_t high = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    uint32_t low = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    length = ((uint64_t)high << 32) | low;
+    p += 8;
+  }
+  frame->payloadLength = length;
+
+  frame->maskingKey = 0;
+  if (frame->isMasked) {
+    memcpy(&frame->maskingKey, p, sizeof(uint32_t));
+    p += 4;
+  }
+
+  frame->payloadData = (char *)p;
+  return p - header;
+}
+
+/* encode a header using the shortest length form, masked if maskingKey
+ * is given.  Returns its length, at most WS_MAX_HEADER_LENGTH */
+uint8_t wsframe_encodeHeader(uint8_t *header, uint8_t flagsOpcode, uint64_t payloadLength, const uint8_t *maskingKey) {
+  uint8_t mask = maskingKey ? IS_MASKED : 0;
+  uint8_t *p = header + 2;
+
+  header[0] = flagsOpcode;
+
+  if (payloadLength < 126) {
+    header[1] = mask | (uint8_t)payloadLength;
+  } else if (payloadLength <= 0xFFFF) {
+    header[1] = mask | 126;
+    p[0] = (uint8_t)(payloadLength >> 8);
+    p[1] = (uint8_t)payloadLength;
+    p += 2;
+  } else {
+    uint32_t high = (uint32_t)(payloadLength >> 32);
+    uint32_t low = (uint32_t)payloadLength;
+    header[1] = mask | 127;
+    p[0] = high >> 24; p[1] = high >> 16; p[2] = high >> 8; p[3] = high;
+    p[4] = low >> 24;  p[5] = low >> 16;  p[6] = low >> 8;  p[7] = low;
+    p += 8;
+  }
+
+  if (maskingKey) {
+    memcpy(p, maskingKey, 4);
+    p += 4;
+  }
+
+  return p - header;
+}
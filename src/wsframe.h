@@ -0,0 +1,70 @@
+// websocket frame header codec (RFC 6455 section 5.2)
+
+#ifndef _WS_FRAME_H_
+#define _WS_FRAME_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* from IEEE RFC6455 sec 5.2
+      0                   1                   2                   3
+      0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+     +-+-+-+-+-------+-+-------------+-------------------------------+
+     |F|R|R|R| opcode|M| Payload len |    Extended payload length    |
+     |I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
+     |N|V|V|V|       |S|             |   (if payload len==126/127)   |
+     | |1|2|3|       |K|             |                               |
+     +-+-+-+-+-------+-+-------------+ - - - - - - - - - - - - - - - +
+     |     Extended payload length continued, if payload len == 127  |
+     + - - - - - - - - - - - - - - - +-------------------------------+
+     |                               |Masking-key, if MASK set to 1  |
+     +-------------------------------+-------------------------------+
+     | Masking-key (continued)       |          Payload Data         |
+     +-------------------------------- - - - - - - - - - - - - - - - +
+     :                     Payload Data continued ...                :
+     + - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - +
+     |                     Payload Data continued ...                |
+     +---------------------------------------------------------------+
+*/
+
+#define FLAG_FIN (1 << 7)
+#define FLAG_RSV1 (1 << 6)
+#define FLAG_RSV2 (1 << 5)
+#define FLAG_RSV3 (1 << 4)
+
+#define OPCODE_CONTINUE 0x0
+#define OPCODE_TEXT 0x1
+#define OPCODE_BINARY 0x2
+#define OPCODE_CLOSE 0x8
+#define OPCODE_PING 0x9
+#define OPCODE_PONG 0xA
+#define OPCODE_CONTROL 0x8 //set for all control frame opcodes
+
+#define FLAGS_MASK ((uint8_t)0xF0)
+#define OPCODE_MASK ((uint8_t)0x0F)
+#define IS_MASKED ((uint8_t)(1<<7))
+#define PAYLOAD_MASK ((uint8_t)0x7F)
+
+#define WS_MAX_HEADER_LENGTH 14
+
+typedef struct WSFrame {
+  uint8_t flags;
+  uint8_t opcode;
+  uint8_t isMasked;
+  uint64_t payloadLength;
+  uint32_t maskingKey;  //in wire order, as used by the unmasking
+  char* payloadData;
+} WSFrame;
+
+uint8_t   wsframe_headerLength(const uint8_t *header);
+uint8_t   wsframe_decodeHeader(const uint8_t *header, WSFrame *frame);
+uint8_t   wsframe_encodeHeader(uint8_t *header, uint8_t flagsOpcode, uint64_t payloadLength, const uint8_t *maskingKey);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WS_FRAME_H_
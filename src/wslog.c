@@ -0,0 +1,69 @@
+/* wslog.c : log line ring buffer and rate limiting */
+/* A line is stored whole or not at all, so the reader never sees half of
+ * one, and the head only moves once its bytes are in place.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "wslog.h"
+
+/* size must be a power of two, up to 32768 */
+void wslog_init(WSLog *log, char *buffer, uint16_t size) {
+  log->buffer = buffer;
+  log->mask = size - 1;
+  log->head = 0;
+  log->tail = 0;
+  log->dropped = 0;
+}
+
+/* whether a line from site may be logged at time now, at most one per
+ * interval; those that may not are counted in site->suppressed */
+int wslog_allow(WSLogSite *site, uint32_t now, uint32_t interval) {
+  if (site->logged && now - site->last < interval) {
+    if (site->suppressed != 0xFFFF) {
+      site->suppressed++;
+    }
+    return 0;
+  }
+  site->last = now;
+  site->logged = 1;
+  return 1;
+}
+
+void wslog_write(WSLog *log, const char *line, uint16_t length) {
+  uint16_t head = log->head;
+  uint16_t room = log->mask + 1 - (uint16_t)(head - log->tail);
+  uint16_t offset = head & log->mask;
+  uint16_t first = log->mask + 1 - offset;
+
+  if (length > room) {
+    log->dropped++;
+    return;
+  }
+
+  if (first > length) {
+    first = length;
+  }
+  memcpy(log->buffer + offset, line, first);
+  memcpy(log->buffer, line + first, length - first);
+  log->head = head + length;
+}
+
+/* copies up to size bytes of logged text to out, returns how many */
+uint16_t wslog_read(WSLog *log, char *out, uint16_t size) {
+  uint16_t tail = log->tail;
+  uint16_t length = log->head - tail;
+  uint16_t offset = tail & log->mask;
+  uint16_t first = log->mask + 1 - offset;
+
+  if (length > size) {
+    length = size;
+  }
+  if (first > length) {
+    first = length;
+  }
+  memcpy(out, log->buffer + offset, first);
+  memcpy(out + first, log->buffer, length - first);
+  log->tail = tail + length;
+  return length;
+}
@@ -0,0 +1,39 @@
+// log ring buffer: formatted lines are dropped into it from anywhere,
+// including network callbacks, and drained later by whoever owns the output
+
+#ifndef _WS_LOG_H_
+#define _WS_LOG_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* one producer and one consumer: only the writer moves head and only the
+ * reader moves tail, both free running, so neither needs a lock */
+typedef struct WSLog {
+  char *buffer;
+  uint16_t mask;            //buffer size - 1, the size being a power of two
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  uint32_t dropped;         //lines that didn't fit
+} WSLog;
+
+/* per call site rate limit */
+typedef struct WSLogSite {
+  uint32_t last;            //time of the last line let through
+  uint16_t suppressed;      //lines held back since then
+  uint8_t logged;           //whether last is set
+} WSLogSite;
+
+void      wslog_init(WSLog *log, char *buffer, uint16_t size);
+int       wslog_allow(WSLogSite *site, uint32_t now, uint32_t interval);
+void      wslog_write(WSLog *log, const char *line, uint16_t length);
+uint16_t  wslog_read(WSLog *log, char *out, uint16_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WS_LOG_H_
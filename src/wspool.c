@@ -0,0 +1,60 @@
+/* wspool.c : fixed-block memory pool */
+/* The free list is threaded through the free blocks themselves, so a pool
+ * needs no memory beyond its blocks and the WSPool header.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "wspool.h"
+
+/* storage must hold WSPOOL_STORAGE_WORDS(blockSize, blockCount) words */
+void wspool_init(WSPool *pool, uint32_t *storage, uint16_t blockSize, uint16_t blockCount) {
+  uint16_t size = WSPOOL_BLOCK_SIZE(blockSize < sizeof(void *) ? sizeof(void *) : blockSize);
+  uint8_t *block = (uint8_t *)storage;
+  void **last = &pool->freeList;
+  uint16_t i;
+
+  pool->blocks = block;
+  pool->end = block + (uint32_t)size * blockCount;
+
+  for (i = 0; i < blockCount; i++) {
+    *last = block;
+    last = (void **)block;
+    block += size;
+  }
+  *last = NULL;
+
+  pool->stats.blockSize = size;
+  pool->stats.blockCount = blockCount;
+  pool->stats.inUse = 0;
+  pool->stats.highWater = 0;
+  pool->stats.failures = 0;
+}
+
+/* returns NULL, and counts a failure, when every block is in use */
+void *wspool_alloc(WSPool *pool) {
+  void **block = (void **)pool->freeList;
+
+  if (block == NULL) {
+    pool->stats.failures++;
+    return NULL;
+  }
+
+  pool->freeList = *block;
+  if (++pool->stats.inUse > pool->stats.highWater) {
+    pool->stats.highWater = pool->stats.inUse;
+  }
+  return block;
+}
+
+/* block must have come from wspool_alloc on the same pool */
+void wspool_free(WSPool *pool, void *block) {
+  *(void **)block = pool->freeList;
+  pool->freeList = block;
+  pool->stats.inUse--;
+}
+
+/* whether block lies in the pool's storage */
+int wspool_owns(const WSPool *pool, const void *block) {
+  return (const uint8_t *)block >= pool->blocks && (const uint8_t *)block < pool->end;
+}
@@ -0,0 +1,44 @@
+// fixed-block memory pool: equal sized blocks carved out of one static
+// array, handed out and taken back in constant time from a free list, so
+// the heap is never fragmented by short lived buffers
+
+#ifndef _WS_POOL_H_
+#define _WS_POOL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* blocks are kept 4 byte aligned, so sizes are rounded up to a multiple of 4 */
+#define WSPOOL_BLOCK_SIZE(size) (((size) + 3UL) & ~3UL)
+
+/* size, in uint32_t, of the storage for count blocks of size bytes */
+#define WSPOOL_STORAGE_WORDS(size, count) (WSPOOL_BLOCK_SIZE(size) / 4 * (count))
+
+typedef struct WSPoolStats {
+  uint16_t blockSize;
+  uint16_t blockCount;
+  uint16_t inUse;
+  uint16_t highWater;   //most blocks ever in use at once
+  uint32_t failures;    //allocations refused because every block was in use
+} WSPoolStats;
+
+typedef struct WSPool {
+  uint8_t *blocks;
+  uint8_t *end;
+  void *freeList;       //each free block starts with a pointer to the next
+  WSPoolStats stats;
+} WSPool;
+
+void      wspool_init(WSPool *pool, uint32_t *storage, uint16_t blockSize, uint16_t blockCount);
+void     *wspool_alloc(WSPool *pool);
+void      wspool_free(WSPool *pool, void *block);
+int       wspool_owns(const WSPool *pool, const void *block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WS_POOL_H_
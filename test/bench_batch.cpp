@@ -0,0 +1,122 @@
+// batched sends: espconn_sent calls and tcp segments per 1000 frames, and
+// ns per frame, for an application emitting groups of three small frames
+// (a status, a reading and an event), each group sent
+//
+//   one frame at a time     sendWsMessage, the queue drained between frames
+//   back to back            sendWsMessage for the whole group, left to the
+//                           transmit queue to coalesce
+//   batch per group         beginWsBatch, three appends, flushWsBatch
+//   batch to the MSS        groups appended until the batch is full
+
+#include <string>
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "bench.h"
+
+#define PORT 9130
+#define GROUPS 100000
+#define FRAMES (GROUPS * 3)
+
+static WebSocketServer<1, 256, 8> server(PORT);
+static SimPeer *peer;
+static const std::string status(40, 's'), reading(24, 'r'), event(60, 'e');
+
+//***********************************************************************
+static void drain( void ) {
+  simRun();
+  peer->inbox.clear();
+}
+
+//***********************************************************************
+static void report(const char *name, uint64_t ns) {
+  printf("%-20s %12.1f %12.1f %10.1f\n", name,
+         1000.0 * simStats.sentCalls / FRAMES, 1000.0 * simStats.segments / FRAMES, (double)ns / FRAMES);
+}
+
+int main() {
+  WSConnection *connection;
+  WSBatch batch;
+  uint64_t ns, start;
+
+  server.begin();
+  peer = peerOpen(PORT);
+  connection = &server.connections[0];
+
+  printf("bench_batch: %d groups of 3 frames, %u, %u and %u bytes\n", GROUPS,
+         (unsigned)status.size(), (unsigned)reading.size(), (unsigned)event.size());
+  printf("%-20s %12s %12s %10s\n", "per 1000 frames", "sent calls", "segments", "ns/frame");
+
+  simResetStats();
+  ns = 0;
+  for (int g = 0; g < GROUPS; g++) {
+    start = benchNowNs();
+    sendWsMessage(connection, status.data(), status.size(), OPCODE_TEXT);
+    ns += benchNowNs() - start;
+    drain();
+    start = benchNowNs();
+    sendWsMessage(connection, reading.data(), reading.size(), OPCODE_TEXT);
+    ns += benchNowNs() - start;
+    drain();
+    start = benchNowNs();
+    sendWsMessage(connection, event.data(), event.size(), OPCODE_TEXT);
+    ns += benchNowNs() - start;
+    drain();
+  }
+  report("one frame at a time", ns);
+
+  simResetStats();
+  ns = 0;
+  for (int g = 0; g < GROUPS; g++) {
+    start = benchNowNs();
+    sendWsMessage(connection, status.data(), status.size(), OPCODE_TEXT);
+    sendWsMessage(connection, reading.data(), reading.size(), OPCODE_TEXT);
+    sendWsMessage(connection, event.data(), event.size(), OPCODE_TEXT);
+    ns += benchNowNs() - start;
+    drain();
+  }
+  report("back to back", ns);
+
+  simResetStats();
+  ns = 0;
+  for (int g = 0; g < GROUPS; g++) {
+    start = benchNowNs();
+    beginWsBatch(&batch, connection);
+    appendWsBatch(&batch, status.data(), status.size(), OPCODE_TEXT);
+    appendWsBatch(&batch, reading.data(), reading.size(), OPCODE_TEXT);
+    appendWsBatch(&batch, event.data(), event.size(), OPCODE_TEXT);
+    flushWsBatch(&batch);
+    ns += benchNowNs() - start;
+    drain();
+  }
+  report("batch per group", ns);
+
+  //frames go into the batch until one doesn't fit, which is flushed and
+  //the frame starts the next
+  simResetStats();
+  ns = 0;
+  start = benchNowNs();
+  beginWsBatch(&batch, connection);
+  for (int g = 0; g < GROUPS; g++) {
+    const std::string *frames[3] = { &status, &reading, &event };
+    for (int f = 0; f < 3; f++) {
+      if (appendWsBatch(&batch, frames[f]->data(), frames[f]->size(), OPCODE_TEXT) != WS_OK) {
+        flushWsBatch(&batch);
+        ns += benchNowNs() - start;
+        drain();
+        start = benchNowNs();
+        beginWsBatch(&batch, connection);
+        appendWsBatch(&batch, frames[f]->data(), frames[f]->size(), OPCODE_TEXT);
+      }
+    }
+  }
+  flushWsBatch(&batch);
+  ns += benchNowNs() - start;
+  drain();
+  report("batch to the MSS", ns);
+
+  simClose(peer);
+  simRun();
+  return 0;
+}
@@ -0,0 +1,67 @@
+// broadcast against sending the message to each connection in turn, the
+// way broadcastWsMessage used to: time per client to encode and queue a
+// 128 byte text message, at 4, 16 and 64 connections.  Draining the
+// queues through the simulator isn't timed.
+
+#define WS_RAM_BUDGET (1 << 20) //64 slots, more than a device would have
+
+#include <string>
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "bench.h"
+
+#define PAYLOAD_SIZE 128
+#define ROUNDS 20000
+
+static WebSocketServer<4, 256, 4> server4(9100);
+static WebSocketServer<16, 256, 4> server16(9101);
+static WebSocketServer<64, 256, 4> server64(9102);
+
+//***********************************************************************
+static void drain(SimPeer **peers, uint8_t count) {
+  simRun();
+  for (uint8_t i = 0; i < count; i++) {
+    peers[i]->inbox.clear();
+  }
+}
+
+//***********************************************************************
+static void measure(WSServer *server, uint8_t count) {
+  SimPeer *peers[64];
+  std::string payload(PAYLOAD_SIZE, 'b');
+  uint64_t broadcastNs = 0, eachNs = 0;
+
+  beginWsServer(server);
+  for (uint8_t i = 0; i < count; i++) {
+    peers[i] = peerOpen(server->port);
+  }
+
+  for (int round = 0; round < ROUNDS; round++) {
+    uint64_t start = benchNowNs();
+    broadcastWsServer(server, payload.data(), PAYLOAD_SIZE, OPCODE_TEXT);
+    broadcastNs += benchNowNs() - start;
+    drain(peers, count);
+
+    start = benchNowNs();
+    for (uint8_t slotId = 0; slotId < count; slotId++) {
+      sendWsMessage(&server->connections[slotId], payload.data(), PAYLOAD_SIZE, OPCODE_TEXT);
+    }
+    eachNs += benchNowNs() - start;
+    drain(peers, count);
+  }
+
+  double perClientBroadcast = (double)broadcastNs / ROUNDS / count;
+  double perClientEach = (double)eachNs / ROUNDS / count;
+  printf("%8u %14.1f %14.1f %8.1fx\n", count, perClientEach, perClientBroadcast, perClientEach / perClientBroadcast);
+}
+
+int main() {
+  printf("bench_broadcast: ns per client for a %d byte message\n", PAYLOAD_SIZE);
+  printf("%8s %14s %14s %9s\n", "clients", "send to each", "broadcast", "speedup");
+  measure(&server4, 4);
+  measure(&server16, 16);
+  measure(&server64, 64);
+  return 0;
+}
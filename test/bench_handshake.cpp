@@ -0,0 +1,68 @@
+// the accept key, from two laid out SHA-1 blocks against the string
+// concatenation and sha1_write it replaced, and whole handshakes through
+// the simulator: upgrade request in, response out, connection closed
+
+#include "easyWebSocket.cpp"
+#include "sim.h"
+#include "peer.h"
+#include "bench.h"
+
+#define PORT 9110
+#define KEYS 2000000
+#define HANDSHAKES 200000
+
+static WebSocketServer<4, 256, 4> server(PORT);
+
+//***********************************************************************
+// The accept key as it was computed before.
+static int createAcceptKeyGeneric(const char *key, char *buffer, int bufferSize) {
+  sha1nfo s;
+  char concatenatedBuffer[512];
+  concatenatedBuffer[0] = '\0';
+  os_strcat(concatenatedBuffer, key);
+  os_strcat(concatenatedBuffer, WS_GUID);
+  sha1_init(&s);
+  sha1_write(&s, concatenatedBuffer, strlen(concatenatedBuffer));
+  return base64_encode(20, sha1_result(&s), bufferSize, buffer);
+}
+
+int main() {
+  char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+  char accept[32];
+
+  uint64_t start = benchNowNs();
+  for (uint32_t i = 0; i < KEYS; i++) {
+    key[i & 15] ^= 1;
+    createAcceptKeyGeneric(key, accept, sizeof(accept));
+    benchSink = accept[0];
+  }
+  double genericNs = (double)(benchNowNs() - start) / KEYS;
+
+  start = benchNowNs();
+  for (uint32_t i = 0; i < KEYS; i++) {
+    key[i & 15] ^= 1;
+    createWsAcceptKey(key, accept, sizeof(accept));
+    benchSink = accept[0];
+  }
+  double blocksNs = (double)(benchNowNs() - start) / KEYS;
+
+  printf("bench_handshake: accept key, ns each\n");
+  printf("%12s %12s %8s\n", "concatenate", "two blocks", "speedup");
+  printf("%12.1f %12.1f %7.1fx\n", genericNs, blocksNs, genericNs / blocksNs);
+
+  server.begin();
+  uint32_t completed = 0;
+  start = benchNowNs();
+  for (uint32_t i = 0; i < HANDSHAKES; i++) {
+    SimPeer *peer = peerOpen(PORT);
+    if (peer != NULL) {
+      completed++;
+      simClose(peer);
+      simRun();
+    }
+  }
+  double seconds = (benchNowNs() - start) / 1e9;
+  printf("bench_handshake: %u/%u handshakes, %.0f handshakes/s including the simulator and the peer\n",
+         (unsigned)completed, HANDSHAKES, completed / seconds);
+  return completed == HANDSHAKES ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// publishing to a topic against the alternatives: broadcasting to every
+// connection and leaving the clients to filter, or the application looping
+// over its own subscriber list.  64 connections, 8 of them subscribed, a
+// 128 byte message; ns per message to encode and queue it, and the bytes
+// it puts on the wire.
+
+#define WS_RAM_BUDGET (1 << 20) //64 slots, more than a device would have
+
+#include <string>
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "bench.h"
+
+#define PORT 9120
+#define SLOTS 64
+#define SUBSCRIBERS 8
+#define PAYLOAD_SIZE 128
+#define ROUNDS 20000
+
+static WebSocketServer<SLOTS, 256, 4> server(PORT);
+static SimPeer *peers[SLOTS];
+static bool subscribed[SLOTS];
+
+//***********************************************************************
+static void drain( void ) {
+  simRun();
+  for (int i = 0; i < SLOTS; i++) {
+    peers[i]->inbox.clear();
+  }
+}
+
+//***********************************************************************
+static void report(const char *name, uint64_t ns, uint64_t bytes) {
+  printf("%-26s %10.0f %12llu\n", name, (double)ns / ROUNDS, (unsigned long long)(bytes / ROUNDS));
+}
+
+int main() {
+  std::string payload(PAYLOAD_SIZE, 't');
+
+  server.begin();
+  int8_t topic = server.addTopic("alerts");
+  for (int i = 0; i < SLOTS; i++) {
+    peers[i] = peerOpen(PORT);
+    //every eighth slot, spread over both words of the subscriber set
+    subscribed[i] = (i % (SLOTS / SUBSCRIBERS)) == 3;
+    if (subscribed[i]) {
+      subscribeWsTopic(&server.connections[i], topic);
+    }
+  }
+
+  uint64_t publishNs = 0, broadcastNs = 0, loopNs = 0;
+  uint64_t publishBytes = 0, broadcastBytes = 0, loopBytes = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    simResetStats();
+    uint64_t start = benchNowNs();
+    server.publish(topic, payload.data(), PAYLOAD_SIZE, OPCODE_TEXT);
+    publishNs += benchNowNs() - start;
+    drain();
+    publishBytes += simStats.bytes;
+
+    simResetStats();
+    start = benchNowNs();
+    server.broadcast(payload.data(), PAYLOAD_SIZE, OPCODE_TEXT);
+    broadcastNs += benchNowNs() - start;
+    drain();
+    broadcastBytes += simStats.bytes;
+
+    simResetStats();
+    start = benchNowNs();
+    for (int i = 0; i < SLOTS; i++) {
+      if (subscribed[i]) {
+        sendWsMessage(&server.connections[i], payload.data(), PAYLOAD_SIZE, OPCODE_TEXT);
+      }
+    }
+    loopNs += benchNowNs() - start;
+    drain();
+    loopBytes += simStats.bytes;
+  }
+
+  printf("bench_pubsub: %d connections, %d subscribed, %d byte message\n", SLOTS, SUBSCRIBERS, PAYLOAD_SIZE);
+  printf("%-26s %10s %12s\n", "", "ns", "wire bytes");
+  report("publish", publishNs, publishBytes);
+  report("broadcast, clients filter", broadcastNs, broadcastBytes);
+  report("sendWsMessage each", loopNs, loopBytes);
+  return 0;
+}
@@ -0,0 +1,38 @@
+// the frame header codec: ns to encode and to decode a header of each
+// length class, masked as a client's frames are
+
+#include "wsframe.h"
+#include "bench.h"
+
+#define ROUNDS 50000000
+
+int main() {
+  static const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  const uint64_t lengths[] = { 100, 1000, 100000 };
+  const char *names[] = { "7 bit", "16 bit", "64 bit" };
+  uint8_t header[WS_MAX_HEADER_LENGTH];
+  WSFrame frame;
+
+  printf("bench_wsframe: ns per header\n");
+  printf("%8s %8s %8s\n", "length", "encode", "decode");
+  for (unsigned i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+    uint32_t sum = 0;
+    uint64_t start = benchNowNs();
+    for (uint32_t r = 0; r < ROUNDS; r++) {
+      //a length that varies keeps the compiler from hoisting the encode
+      sum += wsframe_encodeHeader(header, 0x82, lengths[i] + (r & 1), key);
+    }
+    double encodeNs = (double)(benchNowNs() - start) / ROUNDS;
+
+    start = benchNowNs();
+    for (uint32_t r = 0; r < ROUNDS; r++) {
+      header[0] ^= r & 1;
+      sum += wsframe_decodeHeader(header, &frame) + (uint32_t)frame.payloadLength;
+    }
+    double decodeNs = (double)(benchNowNs() - start) / ROUNDS;
+    benchSink = sum;
+
+    printf("%8s %8.2f %8.2f\n", names[i], encodeNs, decodeNs);
+  }
+  return 0;
+}
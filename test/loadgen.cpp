@@ -0,0 +1,220 @@
+// load generator: many simulated clients open connections to an echo
+// server, each keeps a window of binary frames in flight until it has had
+// its share echoed, then sits idle long enough to be pinged by the
+// keepalive, answers, and closes.
+//
+//   loadgen [--clients N] [--frames M] [--size S] [--window W]
+//           [--segment B] [--seed X]
+//
+// Reports handshakes/s, echoed frames/s and bytes/s, echo latency
+// percentiles and the espconn_sent calls and tcp segments each frame cost.
+// Times are of the host cpu running the library and the simulator.
+
+#define WS_RAM_BUDGET (1 << 20) //the load generator isn't bound by the device's RAM
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+
+#define PORT 9000
+#define MAX_CLIENTS 32
+#define STAMP_SIZE 8
+
+struct Client {
+  SimPeer *peer;
+  uint32_t sent;
+  uint32_t echoed;
+  uint32_t pings;
+  bool closeAnswered;
+};
+
+static WebSocketServer<MAX_CLIENTS, 1024, 16> server(PORT);
+static uint32_t frames = 1000, size = 128, window = 4;
+static std::string filler;
+static std::vector<uint64_t> latencies;
+static uint32_t badEchoes;
+
+//***********************************************************************
+static uint64_t nowNs( void ) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+//***********************************************************************
+static void onData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  sendWsMessage(connection, payload, length, opcode);
+}
+
+//***********************************************************************
+// A frame stamped with the time it was sent, so its echo gives the latency.
+static void sendFrame(Client *client) {
+  std::string payload = filler;
+  uint64_t stamp = nowNs();
+  memcpy(&payload[0], &stamp, STAMP_SIZE);
+  peerSend(client->peer, OPCODE_BINARY, payload);
+  client->sent++;
+}
+
+//***********************************************************************
+static void onReceive(SimPeer *peer, void *context) {
+  Client *client = (Client *)context;
+  PeerFrame frame;
+
+  while (peerRead(peer, &frame)) {
+    if (frame.opcode == OPCODE_PING) {
+      client->pings++;
+      peerSend(peer, OPCODE_PONG, frame.payload);
+    } else if (frame.opcode == OPCODE_CLOSE) {
+      client->closeAnswered = true;
+    } else if (frame.opcode == OPCODE_BINARY && frame.payload.size() == size &&
+               frame.payload.compare(STAMP_SIZE, std::string::npos, filler, STAMP_SIZE, std::string::npos) == 0) {
+      uint64_t stamp;
+      memcpy(&stamp, frame.payload.data(), STAMP_SIZE);
+      latencies.push_back(nowNs() - stamp);
+      client->echoed++;
+      if (client->sent < frames) {
+        sendFrame(client);
+      }
+    } else {
+      badEchoes++;
+    }
+  }
+}
+
+//***********************************************************************
+static uint64_t percentile(double fraction) {
+  size_t index = (size_t)(fraction * (latencies.size() - 1));
+  return latencies[index];
+}
+
+//***********************************************************************
+int main(int argc, char **argv) {
+  uint32_t clients = 16;
+  uint32_t segment = SIM_MSS;
+  uint32_t seed = 1;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    uint32_t value = strtoul(argv[i + 1], NULL, 0);
+    if (strcmp(argv[i], "--clients") == 0) {
+      clients = value;
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      frames = value;
+    } else if (strcmp(argv[i], "--size") == 0) {
+      size = value;
+    } else if (strcmp(argv[i], "--window") == 0) {
+      window = value;
+    } else if (strcmp(argv[i], "--segment") == 0) {
+      segment = value;
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      seed = value;
+    } else {
+      fprintf(stderr, "loadgen: unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (clients < 1 || clients > MAX_CLIENTS || size < STAMP_SIZE || size > 1024 || window < 1 || segment < 1) {
+    fprintf(stderr, "loadgen: 1-%d clients, frames of %d-1024 bytes, a window and segment of at least 1\n",
+            MAX_CLIENTS, STAMP_SIZE);
+    return 2;
+  }
+
+  srand(seed);
+  filler.resize(size);
+  for (uint32_t i = 0; i < size; i++) {
+    filler[i] = (char)rand();
+  }
+  latencies.reserve((size_t)clients * frames);
+  simSetSegment(segment);
+
+  server.setDataCallback(onData, NULL);
+  server.begin();
+  int64_t heapBefore = simHeapInUse();
+  std::vector<Client> pool(clients);
+
+  //handshakes, all at once
+  uint64_t start = nowNs();
+  uint32_t opened = 0;
+  for (uint32_t i = 0; i < clients; i++) {
+    pool[i].peer = simConnect(PORT);
+    simWrite(pool[i].peer, peerRequest("dGhlIHNhbXBsZSBub25jZQ==", ""));
+  }
+  simRun();
+  for (uint32_t i = 0; i < clients; i++) {
+    std::string &inbox = pool[i].peer->inbox;
+    size_t end = inbox.find("\r\n\r\n");
+    if (end != std::string::npos && inbox.compare(0, 12, "HTTP/1.1 101") == 0 &&
+        inbox.find(peerAcceptKey("dGhlIHNhbXBsZSBub25jZQ==")) < end) {
+      opened++;
+    }
+    inbox.erase(0, end == std::string::npos ? inbox.size() : end + 4);
+    pool[i].peer->onReceive = onReceive;
+    pool[i].peer->context = &pool[i];
+  }
+  uint64_t handshakeNs = nowNs() - start;
+
+  //echo traffic, with a simulated 100 ms passing every hundred events
+  simResetStats();
+  start = nowNs();
+  for (uint32_t i = 0; i < clients; i++) {
+    for (uint32_t j = 0; j < window && pool[i].sent < frames; j++) {
+      sendFrame(&pool[i]);
+    }
+  }
+  for (;;) {
+    bool busy = false;
+    for (int i = 0; i < 100 && (busy = simStep()); i++) {
+    }
+    if (!busy) {
+      break;
+    }
+    simAdvance(100);
+  }
+  uint64_t echoNs = nowNs() - start;
+  SimStats traffic = simStats;
+
+  //an idle spell long enough for the keepalive to ping everyone, then
+  //goodbye
+  simAdvance((WS_PING_INTERVAL + 1) * WS_TIMER_TICK);
+  for (uint32_t i = 0; i < clients; i++) {
+    peerSend(pool[i].peer, OPCODE_CLOSE, "");
+  }
+  simAdvance(WS_CLOSE_TIMEOUT * WS_TIMER_TICK);
+
+  uint32_t echoed = 0, pings = 0, closed = 0;
+  for (uint32_t i = 0; i < clients; i++) {
+    echoed += pool[i].echoed;
+    pings += pool[i].pings;
+    closed += pool[i].closeAnswered && pool[i].peer->closed;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  double echoSeconds = echoNs / 1e9;
+
+  printf("loadgen: %u clients, %u frames of %u bytes each, window %u, segment %u\n",
+         clients, frames, size, window, segment);
+  printf("  handshakes     %u of %u, %.0f/s\n", opened, clients, opened / (handshakeNs / 1e9));
+  printf("  echoed         %u of %u frames, %u bad\n", echoed, clients * frames, badEchoes);
+  printf("  throughput     %.0f frames/s, %.2f MB/s each way\n",
+         echoed / echoSeconds, (double)echoed * size / echoSeconds / 1e6);
+  if (!latencies.empty()) {
+    printf("  latency us     p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(0.50) / 1e3, percentile(0.90) / 1e3, percentile(0.99) / 1e3, latencies.back() / 1e3);
+  }
+  if (echoed != 0) {
+    printf("  espconn_sent   %.3f calls and %.3f segments per echoed frame, %u refused as overlapping\n",
+           (double)traffic.sentCalls / echoed, (double)traffic.segments / echoed, traffic.overlapped);
+  }
+  printf("  keepalive      %u pings answered\n", pings);
+  printf("  closes         %u of %u answered and closed\n", closed, clients);
+  printf("  heap           %lld bytes still allocated\n", (long long)(simHeapInUse() - heapBefore));
+
+  bool ok = opened == clients && echoed == clients * frames && badEchoes == 0 && closed == clients &&
+            traffic.overlapped == 0 && pings >= clients && simHeapInUse() == heapBefore;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+// host stand-in for the parts of the ESP8266 Arduino core the library uses
+
+#ifndef _ARDUINO_H_
+#define _ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+extern "C" {
+#include "c_types.h"
+#include "osapi.h"
+}
+
+//the serial port, written into the simulator's capture
+class HardwareSerial {
+public:
+  int availableForWrite( void );
+  size_t write(const uint8_t *data, size_t length);
+};
+
+class EspClass {
+public:
+  uint32_t getCycleCount( void ); //an 80 MHz count of real time
+};
+
+extern HardwareSerial Serial;
+extern EspClass ESP;
+
+#endif // _ARDUINO_H_
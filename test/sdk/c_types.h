@@ -0,0 +1,20 @@
+// host stand-in for the ESP8266 SDK's c_types.h
+
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint8_t uint8;
+typedef int8_t sint8;
+typedef uint16_t uint16;
+typedef int16_t sint16;
+typedef uint32_t uint32;
+typedef int32_t sint32;
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+
+#endif // _C_TYPES_H_
@@ -0,0 +1,59 @@
+// host stand-in for the ESP8266 SDK's osapi.h: the os_* memory and string
+// functions map onto the C library, allocations are counted by the
+// simulator, and timers run off the simulator's clock
+
+#ifndef _OSAPI_H_
+#define _OSAPI_H_
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define os_memcpy memcpy
+#define os_memmove memmove
+#define os_memset memset
+#define os_memcmp memcmp
+#define os_strlen strlen
+#define os_strcat strcat
+#define os_strcmp strcmp
+#define os_strncmp strncmp
+#define os_strstr strstr
+#define os_sprintf sprintf
+#define os_snprintf snprintf
+
+void     *sim_malloc(size_t size);
+void     *sim_zalloc(size_t size);
+void      sim_free(void *block);
+#define os_malloc sim_malloc
+#define os_zalloc sim_zalloc
+#define os_free sim_free
+
+typedef void ETSTimerFunc(void *timer_arg);
+
+typedef struct _ETSTIMER_ {
+  struct _ETSTIMER_ *timer_next;  //armed timers, kept by the simulator
+  uint32_t timer_expire;          //simulated milliseconds
+  uint32_t timer_period;          //0 for a one shot timer
+  ETSTimerFunc *timer_func;
+  void *timer_arg;
+} ETSTimer;
+
+typedef ETSTimer os_timer_t;
+
+void      os_timer_setfn(os_timer_t *timer, ETSTimerFunc *func, void *arg);
+void      os_timer_arm(os_timer_t *timer, uint32_t ms, bool repeat);
+void      os_timer_disarm(os_timer_t *timer);
+
+unsigned long os_random(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _OSAPI_H_
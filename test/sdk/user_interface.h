@@ -0,0 +1,19 @@
+// host stand-in for the ESP8266 SDK's user_interface.h
+
+#ifndef _USER_INTERFACE_H_
+#define _USER_INTERFACE_H_
+
+#include "c_types.h"
+#include "osapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t  system_get_time(void); //microseconds of simulated time
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _USER_INTERFACE_H_
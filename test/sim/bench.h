@@ -0,0 +1,20 @@
+// timing for the benchmarks.  The times are of the host cpu, so compare
+// the numbers a benchmark prints with each other, not with a device.
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+//written with results the compiler must not optimise away
+static volatile uint32_t benchSink;
+
+static inline uint64_t benchNowNs( void ) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+#endif // _BENCH_H_
@@ -0,0 +1,32 @@
+// assertions for the host tests: a failed CHECK is reported and counted,
+// and the test carries on; checkResult gives main its exit status
+
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+static int checkFailures;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+      checkFailures++; \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+    } \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+    long long checkActual = (long long)(actual), checkExpected = (long long)(expected); \
+    if (checkActual != checkExpected) { \
+      checkFailures++; \
+      fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+              __FILE__, __LINE__, #actual, #expected, checkActual, checkExpected); \
+    } \
+  } while (0)
+
+static inline int checkResult(const char *name) {
+  printf("%s: %s\n", name, checkFailures == 0 ? "ok" : "FAILED");
+  return checkFailures == 0 ? 0 : 1;
+}
+
+#endif // _CHECK_H_
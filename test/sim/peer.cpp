@@ -0,0 +1,256 @@
+// the test's end of a websocket connection, see peer.h
+
+#include <string.h>
+
+#include "peer.h"
+
+#define PEER_KEY "dGhlIHNhbXBsZSBub25jZQ=="
+#define PEER_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static uint32_t peerMaskSeed = 0x12345678;
+
+//***********************************************************************
+// FIPS 180-4 SHA-1, kept apart from the library's
+static uint32_t peerRotate(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+static std::string peerSha1(const std::string &message) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  std::string data = message;
+  uint64_t bits = (uint64_t)message.size() * 8;
+
+  data += (char)0x80;
+  while (data.size() % 64 != 56) {
+    data += (char)0;
+  }
+  for (int i = 7; i >= 0; i--) {
+    data += (char)(bits >> (i * 8));
+  }
+
+  for (size_t block = 0; block < data.size(); block += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t *p = (const uint8_t *)data.data() + block + i * 4;
+      w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = peerRotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = peerRotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = peerRotate(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  std::string digest;
+  for (int i = 0; i < 20; i++) {
+    digest += (char)(h[i / 4] >> (24 - (i % 4) * 8));
+  }
+  return digest;
+}
+
+//***********************************************************************
+static std::string peerBase64(const std::string &data) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t group = (uint8_t)data[i] << 16;
+    if (i + 1 < data.size()) {
+      group |= (uint8_t)data[i + 1] << 8;
+    }
+    if (i + 2 < data.size()) {
+      group |= (uint8_t)data[i + 2];
+    }
+    out += alphabet[(group >> 18) & 63];
+    out += alphabet[(group >> 12) & 63];
+    out += (i + 1 < data.size()) ? alphabet[(group >> 6) & 63] : '=';
+    out += (i + 2 < data.size()) ? alphabet[group & 63] : '=';
+  }
+  return out;
+}
+
+//***********************************************************************
+std::string peerAcceptKey(const std::string &key) {
+  return peerBase64(peerSha1(key + PEER_GUID));
+}
+
+//***********************************************************************
+std::string peerRequest(const char *key, const char *extraHeaders) {
+  return std::string("GET /ws HTTP/1.1\r\nHost: device\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n") +
+         "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n" + extraHeaders + "\r\n";
+}
+
+//***********************************************************************
+// Sends the upgrade request and checks the response is a 101 carrying the
+// right accept key.  The response is taken out of the inbox, and handed
+// back through response if asked for.
+bool peerHandshake(SimPeer *peer, const char *extraHeaders, std::string *response) {
+  simWrite(peer, peerRequest(PEER_KEY, extraHeaders));
+  simRun();
+
+  size_t end = peer->inbox.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    return false;
+  }
+  std::string head = peer->inbox.substr(0, end + 4);
+  peer->inbox.erase(0, end + 4);
+  if (response != NULL) {
+    *response = head;
+  }
+  return head.compare(0, 12, "HTTP/1.1 101") == 0 &&
+         head.find("\r\nSec-WebSocket-Accept: " + peerAcceptKey(PEER_KEY) + "\r\n") != std::string::npos;
+}
+
+//***********************************************************************
+// The head of the upgrade request a library client has sent the peer,
+// taken out of the inbox; empty if it hasn't all arrived.
+std::string peerTakeRequest(SimPeer *peer) {
+  size_t end = peer->inbox.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    return std::string();
+  }
+  std::string head = peer->inbox.substr(0, end + 4);
+  peer->inbox.erase(0, end + 4);
+  return head;
+}
+
+//***********************************************************************
+// A 101 response accepting request, with extraHeaders added.
+std::string peerResponse(const std::string &request, const char *extraHeaders) {
+  std::string key;
+  size_t start = request.find("\r\nSec-WebSocket-Key: ");
+  if (start != std::string::npos) {
+    start += 21;
+    key = request.substr(start, request.find("\r\n", start) - start);
+  }
+  return "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+         "Sec-WebSocket-Accept: " + peerAcceptKey(key) + "\r\n" + extraHeaders + "\r\n";
+}
+
+//***********************************************************************
+SimPeer *peerOpen(uint16_t port, const char *extraHeaders) {
+  SimPeer *peer = simConnect(port);
+  if (peer == NULL || !peerHandshake(peer, extraHeaders)) {
+    return NULL;
+  }
+  return peer;
+}
+
+//***********************************************************************
+std::string peerEncode(uint8_t opcode, const std::string &payload, bool mask, bool fin, bool rsv1) {
+  std::string frame;
+  uint64_t length = payload.size();
+
+  frame += (char)((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | opcode);
+  uint8_t maskBit = mask ? 0x80 : 0;
+  if (length < 126) {
+    frame += (char)(maskBit | length);
+  } else if (length < 65536) {
+    frame += (char)(maskBit | 126);
+    frame += (char)(length >> 8);
+    frame += (char)length;
+  } else {
+    frame += (char)(maskBit | 127);
+    for (int i = 7; i >= 0; i--) {
+      frame += (char)(length >> (i * 8));
+    }
+  }
+
+  if (!mask) {
+    return frame + payload;
+  }
+  peerMaskSeed = peerMaskSeed * 1103515245 + 12345;
+  uint8_t key[4] = { (uint8_t)(peerMaskSeed >> 24), (uint8_t)(peerMaskSeed >> 16),
+                     (uint8_t)(peerMaskSeed >> 8), (uint8_t)peerMaskSeed };
+  frame.append((const char *)key, 4);
+  for (size_t i = 0; i < payload.size(); i++) {
+    frame += (char)(payload[i] ^ key[i % 4]);
+  }
+  return frame;
+}
+
+//***********************************************************************
+// Takes one whole frame off the front of stream; false if it doesn't hold
+// one yet.
+bool peerDecode(std::string &stream, PeerFrame *frame) {
+  const uint8_t *bytes = (const uint8_t *)stream.data();
+  size_t have = stream.size();
+  size_t header = 2;
+
+  if (have < 2) {
+    return false;
+  }
+  uint64_t length = bytes[1] & 0x7F;
+  if (length == 126) {
+    header = 4;
+  } else if (length == 127) {
+    header = 10;
+  }
+  bool masked = (bytes[1] & 0x80) != 0;
+  if (have < header + (masked ? 4 : 0)) {
+    return false;
+  }
+  if (length == 126) {
+    length = ((uint64_t)bytes[2] << 8) | bytes[3];
+  } else if (length == 127) {
+    length = 0;
+    for (int i = 0; i < 8; i++) {
+      length = (length << 8) | bytes[2 + i];
+    }
+  }
+  const uint8_t *key = bytes + header;
+  if (masked) {
+    header += 4;
+  }
+  if (have < header + length) {
+    return false;
+  }
+
+  frame->fin = (bytes[0] & 0x80) != 0;
+  frame->rsv1 = (bytes[0] & 0x40) != 0;
+  frame->opcode = bytes[0] & 0x0F;
+  frame->masked = masked;
+  frame->payload.assign((const char *)bytes + header, length);
+  if (masked) {
+    for (size_t i = 0; i < length; i++) {
+      frame->payload[i] ^= key[i % 4];
+    }
+  }
+  stream.erase(0, header + length);
+  return true;
+}
+
+//***********************************************************************
+void peerSend(SimPeer *peer, uint8_t opcode, const std::string &payload) {
+  simWrite(peer, peerEncode(opcode, payload));
+}
+
+//***********************************************************************
+bool peerRead(SimPeer *peer, PeerFrame *frame) {
+  return peerDecode(peer->inbox, frame);
+}
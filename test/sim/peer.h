@@ -0,0 +1,34 @@
+// the remote end of a websocket connection, played by a test through a
+// SimPeer.  Frames are built and parsed here, and the handshake checked,
+// with code of its own rather than the library's, so a test can't pass
+// because both ends share a mistake.
+
+#ifndef _PEER_H_
+#define _PEER_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "sim.h"
+
+struct PeerFrame {
+  bool fin;
+  bool rsv1;
+  uint8_t opcode;
+  bool masked;
+  std::string payload;     //unmasked
+};
+
+std::string peerAcceptKey(const std::string &key);
+std::string peerRequest(const char *key, const char *extraHeaders);
+bool        peerHandshake(SimPeer *peer, const char *extraHeaders = "", std::string *response = NULL);
+SimPeer    *peerOpen(uint16_t port, const char *extraHeaders = "");
+std::string peerTakeRequest(SimPeer *peer);
+std::string peerResponse(const std::string &request, const char *extraHeaders = "");
+
+std::string peerEncode(uint8_t opcode, const std::string &payload, bool mask = true, bool fin = true, bool rsv1 = false);
+bool        peerDecode(std::string &stream, PeerFrame *frame);
+void        peerSend(SimPeer *peer, uint8_t opcode, const std::string &payload);
+bool        peerRead(SimPeer *peer, PeerFrame *frame);
+
+#endif // _PEER_H_
@@ -0,0 +1,526 @@
+// loopback stand-in for the ESP8266 SDK, see sim.h
+
+#include <time.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <Arduino.h>
+extern "C" {
+#include "user_interface.h"
+#include "espconn.h"
+}
+#include "sim.h"
+
+//both ends of one tcp connection.  The device end is the espconn the
+//listening library sees; the remote end is a library client's espconn, or
+//else the peer.  When a library client connects to a port the test listens
+//on, the peer takes the device end instead.
+struct SimLink {
+  struct espconn device;
+  esp_tcp deviceTcp;
+  struct espconn *remote;
+  SimPeer peer;
+  bool peerListens;       //the peer is the device end
+  bool open;
+  bool closing;
+  bool sending[2];        //indexed by end
+};
+
+#define END_DEVICE 0
+#define END_REMOTE 1
+
+SimStats simStats;
+
+static std::deque<std::function<void()> > simEvents;
+static std::map<int, struct espconn *> simListeners;
+static std::map<int, std::deque<SimPeer *> > simPeerListeners;
+static std::map<struct espconn *, SimLink *> simEnds;
+static std::vector<SimLink *> simLinks;
+static struct SimLinkOwner {
+  ~SimLinkOwner() {
+    for (size_t i = 0; i < simLinks.size(); i++) {
+      delete simLinks[i];
+    }
+  }
+} simLinkOwner;
+static ETSTimer *simTimers;
+static uint64_t simClock;           //microseconds
+static uint16_t simSegment = SIM_MSS;
+static uint32_t simFailCount;
+static sint8 simFailError;
+static uint32_t simRandom = 2463534242u;
+static uint16_t simNextPort = 49152;
+static uint16_t simNextPeerPort = 40000;
+static int64_t simHeap;
+static uint64_t simAllocs;
+static std::string simSerialOutput;
+static int simSerialRoom = 1 << 20;
+
+HardwareSerial Serial;
+EspClass ESP;
+
+//***********************************************************************
+static SimLink *simFindEnd(struct espconn *espconn, int *end) {
+  std::map<struct espconn *, SimLink *>::iterator found = simEnds.find(espconn);
+  if (found == simEnds.end()) {
+    return NULL;
+  }
+  *end = (espconn == &found->second->device) ? END_DEVICE : END_REMOTE;
+  return found->second;
+}
+
+//***********************************************************************
+// A new link whose device end takes its callbacks from the listener, as
+// the SDK's accepted connections do.
+static SimLink *simAccept(struct espconn *listener, int remotePort) {
+  SimLink *link = new SimLink();
+  link->device.type = ESPCONN_TCP;
+  link->device.state = ESPCONN_CONNECT;
+  link->device.proto.tcp = &link->deviceTcp;
+  link->device.recv_callback = listener->recv_callback;
+  link->device.sent_callback = listener->sent_callback;
+  link->deviceTcp = *listener->proto.tcp;
+  link->deviceTcp.remote_port = remotePort;
+  link->deviceTcp.remote_ip[0] = 10;
+  link->deviceTcp.remote_ip[1] = 0;
+  link->deviceTcp.remote_ip[2] = remotePort >> 8;
+  link->deviceTcp.remote_ip[3] = remotePort & 0xFF;
+  link->open = true;
+  simLinks.push_back(link);
+  simEnds[&link->device] = link;
+  return link;
+}
+
+//***********************************************************************
+// Hands data to a library espconn in pieces of at most simSegment bytes.
+// Each piece is overwritten once the callback returns, as the SDK reuses
+// its buffers, so anything the library keeps a pointer to goes bad.
+static void simReceive(SimLink *link, struct espconn *espconn, const std::string &data) {
+  for (size_t offset = 0; offset < data.size() && link->open; offset += simSegment) {
+    size_t length = data.size() - offset;
+    if (length > simSegment) {
+      length = simSegment;
+    }
+    std::vector<char> segment(data.begin() + offset, data.begin() + offset + length);
+    simStats.recvCalls++;
+    if (espconn->recv_callback != NULL) {
+      espconn->recv_callback(espconn, segment.data(), length);
+    }
+    memset(segment.data(), 0xEE, length);
+  }
+}
+
+//***********************************************************************
+// Data handed to espconn_sent arrives, read only now as the SDK doesn't
+// copy it, and the sender hears that it has gone.
+static void simDeliver(SimLink *link, int end, const uint8 *data, uint16 length) {
+  if (!link->open) {
+    return;
+  }
+  std::string bytes((const char *)data, length);
+  struct espconn *sender = (end == END_DEVICE) ? &link->device : link->remote;
+
+  if (end == END_REMOTE && !link->peerListens) {
+    simReceive(link, &link->device, bytes);
+  } else if (end == END_DEVICE && link->remote != NULL) {
+    simReceive(link, link->remote, bytes);
+  } else {
+    link->peer.inbox += bytes;
+    if (link->peer.onReceive != NULL) {
+      link->peer.onReceive(&link->peer, link->peer.context);
+    }
+  }
+
+  link->sending[end] = false;
+  if (link->open && sender->sent_callback != NULL) {
+    sender->sent_callback(sender);
+  }
+}
+
+//***********************************************************************
+// Both ends hear that the connection has gone, except one that aborted it.
+static void simDrop(SimLink *link, int aborted) {
+  if (!link->open && aborted < 0) {
+    return;
+  }
+  link->open = false;
+  if (link->peerListens) {
+    link->peer.closed = true;
+  } else if (aborted != END_DEVICE && link->deviceTcp.disconnect_callback != NULL) {
+    link->deviceTcp.disconnect_callback(&link->device);
+  }
+  if (link->remote == NULL) {
+    link->peer.closed = true;
+  } else if (aborted != END_REMOTE && link->remote->proto.tcp->disconnect_callback != NULL) {
+    link->remote->proto.tcp->disconnect_callback(link->remote);
+  }
+}
+
+//***********************************************************************
+SimPeer *simConnect(uint16_t port) {
+  std::map<int, struct espconn *>::iterator listener = simListeners.find(port);
+  if (listener == simListeners.end()) {
+    return NULL;
+  }
+  SimLink *link = simAccept(listener->second, simNextPeerPort++);
+  link->peer.link = link;
+  if (listener->second->proto.tcp->connect_callback != NULL) {
+    listener->second->proto.tcp->connect_callback(&link->device);
+  }
+  return &link->peer;
+}
+
+//***********************************************************************
+// The test plays a server on port: library clients connecting to it are
+// answered by peers, handed out by simAccepted.
+void simListen(uint16_t port) {
+  simPeerListeners[port];
+}
+
+//***********************************************************************
+// The oldest connection made to a port the test listens on and not yet
+// handed out, or NULL.
+SimPeer *simAccepted(uint16_t port) {
+  std::deque<SimPeer *> &accepted = simPeerListeners[port];
+  if (accepted.empty()) {
+    return NULL;
+  }
+  SimPeer *peer = accepted.front();
+  accepted.pop_front();
+  return peer;
+}
+
+//***********************************************************************
+void simWrite(SimPeer *peer, const void *data, size_t length) {
+  SimLink *link = peer->link;
+  std::string bytes((const char *)data, length);
+  simEvents.push_back([link, bytes]() { simReceive(link, link->peerListens ? link->remote : &link->device, bytes); });
+}
+
+void simWrite(SimPeer *peer, const std::string &data) {
+  simWrite(peer, data.data(), data.size());
+}
+
+//***********************************************************************
+void simClose(SimPeer *peer) {
+  SimLink *link = peer->link;
+  simEvents.push_back([link]() { simDrop(link, -1); });
+}
+
+//***********************************************************************
+// Runs the oldest pending event; false if there was none.
+bool simStep( void ) {
+  if (simEvents.empty()) {
+    return false;
+  }
+  std::function<void()> event = simEvents.front();
+  simEvents.pop_front();
+  event();
+  return true;
+}
+
+//***********************************************************************
+void simRun( void ) {
+  while (simStep()) {
+  }
+}
+
+//***********************************************************************
+// Moves the clock on by ms, firing the timers that fall due on the way,
+// each at its own time, and running the events they cause.
+void simAdvance(uint32_t ms) {
+  uint64_t target = simClock + (uint64_t)ms * 1000;
+
+  simRun();
+  for (;;) {
+    ETSTimer *due = NULL;
+    for (ETSTimer *timer = simTimers; timer != NULL; timer = timer->timer_next) {
+      if ((uint64_t)timer->timer_expire * 1000 <= target && (due == NULL || timer->timer_expire < due->timer_expire)) {
+        due = timer;
+      }
+    }
+    if (due == NULL) {
+      break;
+    }
+    simClock = (uint64_t)due->timer_expire * 1000;
+    os_timer_disarm(due);
+    if (due->timer_period != 0) {
+      os_timer_arm(due, due->timer_period, true);
+    }
+    due->timer_func(due->timer_arg);
+    simRun();
+  }
+  simClock = target;
+}
+
+//***********************************************************************
+uint32_t simNow( void ) {
+  return (uint32_t)simClock;
+}
+
+//***********************************************************************
+// The next count espconn_sent calls fail with error, without sending.
+void simFailSends(uint32_t count, sint8 error) {
+  simFailCount = count;
+  simFailError = error;
+}
+
+//***********************************************************************
+// The largest piece of data handed to a recv callback at once.
+void simSetSegment(uint16_t size) {
+  simSegment = size;
+}
+
+//***********************************************************************
+void simResetStats( void ) {
+  memset(&simStats, 0, sizeof(simStats));
+}
+
+//***********************************************************************
+int64_t simHeapInUse( void ) {
+  return simHeap;
+}
+
+uint64_t simHeapAllocs( void ) {
+  return simAllocs;
+}
+
+//***********************************************************************
+std::string &simSerial( void ) {
+  return simSerialOutput;
+}
+
+void simSetSerialRoom(int room) {
+  simSerialRoom = room;
+}
+
+//***********************************************************************
+int HardwareSerial::availableForWrite( void ) {
+  return simSerialRoom;
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t length) {
+  simSerialOutput.append((const char *)data, length);
+  return length;
+}
+
+uint32_t EspClass::getCycleCount( void ) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)((uint64_t)now.tv_sec * 80000000u + now.tv_nsec * 2 / 25);
+}
+
+extern "C" {
+
+//***********************************************************************
+// Allocations carry their size in front, so the heap in use can be counted.
+void *sim_malloc(size_t size) {
+  uint8_t *block = (uint8_t *)malloc(size + 16);
+  if (block == NULL) {
+    return NULL;
+  }
+  *(size_t *)block = size;
+  simHeap += size;
+  simAllocs++;
+  return block + 16;
+}
+
+void *sim_zalloc(size_t size) {
+  void *block = sim_malloc(size);
+  if (block != NULL) {
+    memset(block, 0, size);
+  }
+  return block;
+}
+
+void sim_free(void *block) {
+  if (block == NULL) {
+    return;
+  }
+  uint8_t *start = (uint8_t *)block - 16;
+  simHeap -= *(size_t *)start;
+  free(start);
+}
+
+//***********************************************************************
+void os_timer_setfn(os_timer_t *timer, ETSTimerFunc *func, void *arg) {
+  timer->timer_func = func;
+  timer->timer_arg = arg;
+}
+
+void os_timer_arm(os_timer_t *timer, uint32_t ms, bool repeat) {
+  os_timer_disarm(timer);
+  timer->timer_expire = (uint32_t)(simClock / 1000) + ms;
+  timer->timer_period = repeat ? ms : 0;
+  timer->timer_next = simTimers;
+  simTimers = timer;
+}
+
+void os_timer_disarm(os_timer_t *timer) {
+  for (ETSTimer **link = &simTimers; *link != NULL; link = &(*link)->timer_next) {
+    if (*link == timer) {
+      *link = timer->timer_next;
+      break;
+    }
+  }
+  timer->timer_next = NULL;
+}
+
+//***********************************************************************
+// xorshift32, the same sequence every run.
+unsigned long os_random(void) {
+  simRandom ^= simRandom << 13;
+  simRandom ^= simRandom >> 17;
+  simRandom ^= simRandom << 5;
+  return simRandom;
+}
+
+uint32_t system_get_time(void) {
+  return (uint32_t)simClock;
+}
+
+//***********************************************************************
+sint8 espconn_accept(struct espconn *espconn) {
+  if (simListeners.count(espconn->proto.tcp->local_port) != 0) {
+    return ESPCONN_ISCONN;
+  }
+  simListeners[espconn->proto.tcp->local_port] = espconn;
+  return ESPCONN_OK;
+}
+
+//***********************************************************************
+// The connection is made, or refused through the reconnect callback, when
+// the event queue next runs.
+sint8 espconn_connect(struct espconn *espconn) {
+  simEvents.push_back([espconn]() {
+    std::map<int, std::deque<SimPeer *> >::iterator peerListener = simPeerListeners.find(espconn->proto.tcp->remote_port);
+    if (peerListener != simPeerListeners.end()) {
+      SimLink *link = new SimLink();
+      link->remote = espconn;
+      link->peer.link = link;
+      link->peerListens = true;
+      link->open = true;
+      simLinks.push_back(link);
+      simEnds[espconn] = link;
+      peerListener->second.push_back(&link->peer);
+      if (espconn->proto.tcp->connect_callback != NULL) {
+        espconn->proto.tcp->connect_callback(espconn);
+      }
+      return;
+    }
+    std::map<int, struct espconn *>::iterator listener = simListeners.find(espconn->proto.tcp->remote_port);
+    if (listener == simListeners.end()) {
+      if (espconn->proto.tcp->reconnect_callback != NULL) {
+        espconn->proto.tcp->reconnect_callback(espconn, ESPCONN_RST);
+      }
+      return;
+    }
+    SimLink *link = simAccept(listener->second, espconn->proto.tcp->local_port);
+    link->remote = espconn;
+    simEnds[espconn] = link;
+    if (listener->second->proto.tcp->connect_callback != NULL) {
+      listener->second->proto.tcp->connect_callback(&link->device);
+    }
+    if (link->open && espconn->proto.tcp->connect_callback != NULL) {
+      espconn->proto.tcp->connect_callback(espconn);
+    }
+  });
+  return ESPCONN_OK;
+}
+
+//***********************************************************************
+sint8 espconn_disconnect(struct espconn *espconn) {
+  int end;
+  SimLink *link = simFindEnd(espconn, &end);
+  if (link == NULL || !link->open) {
+    return ESPCONN_ARG;
+  }
+  if (!link->closing) {
+    link->closing = true;
+    simEvents.push_back([link]() { simDrop(link, -1); });
+  }
+  return ESPCONN_OK;
+}
+
+//***********************************************************************
+// Drops the connection at once, with no callback for the end that aborted.
+sint8 espconn_abort(struct espconn *espconn) {
+  int end;
+  SimLink *link = simFindEnd(espconn, &end);
+  if (link == NULL || !link->open) {
+    return ESPCONN_ARG;
+  }
+  link->open = false;
+  simEvents.push_back([link, end]() { simDrop(link, end); });
+  return ESPCONN_OK;
+}
+
+//***********************************************************************
+// Only one send may be in flight on a connection, as with the SDK; the data
+// is read when it is delivered, not now.
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length) {
+  int end;
+  SimLink *link = simFindEnd(espconn, &end);
+  if (link == NULL || !link->open) {
+    return ESPCONN_CONN;
+  }
+  if (simFailCount > 0) {
+    simFailCount--;
+    simStats.refused++;
+    return simFailError;
+  }
+  if (link->sending[end]) {
+    simStats.overlapped++;
+    return ESPCONN_MAXNUM;
+  }
+
+  link->sending[end] = true;
+  simStats.sentCalls++;
+  simStats.segments += (length + SIM_MSS - 1) / SIM_MSS;
+  simStats.bytes += length;
+  simEvents.push_back([link, end, psent, length]() { simDeliver(link, end, psent, length); });
+  return ESPCONN_OK;
+}
+
+//***********************************************************************
+uint32 espconn_port(void) {
+  return simNextPort++;
+}
+
+sint8 espconn_set_opt(struct espconn *espconn, uint8 opt) {
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_time(struct espconn *espconn, uint32 interval, uint8 type_flag) {
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb) {
+  espconn->proto.tcp->connect_callback = connect_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb) {
+  espconn->proto.tcp->reconnect_callback = recon_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb) {
+  espconn->proto.tcp->disconnect_callback = discon_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb) {
+  espconn->recv_callback = recv_cb;
+  return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb) {
+  espconn->sent_callback = sent_cb;
+  return ESPCONN_OK;
+}
+
+}
@@ -0,0 +1,69 @@
+// loopback stand-in for the ESP8266 SDK.  espconn connections are joined in
+// memory, timers run off a simulated clock, and nothing happens until the
+// test runs the event queue, so every run is deterministic.
+//
+// The device side is the library, listening with espconn_accept or
+// connecting out with espconn_connect.  The far side is either another
+// library espconn (a WebSocketClient talking to a WebSocketServer) or a
+// SimPeer, a tcp end played by the test, which can also listen for a
+// WebSocketClient with simListen.
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+extern "C" {
+#include "espconn.h"
+}
+
+#define SIM_MSS 1460
+
+//what crossed the simulated network since simResetStats
+struct SimStats {
+  uint32_t sentCalls;     //espconn_sent calls accepted
+  uint32_t segments;      //tcp segments those filled, SIM_MSS bytes each
+  uint64_t bytes;
+  uint32_t refused;       //espconn_sent calls failed on purpose, see simFailSends
+  uint32_t overlapped;    //espconn_sent calls made while the previous one was in flight
+  uint32_t recvCalls;     //recv callbacks made into the library
+};
+
+struct SimLink;
+
+//the remote end of a tcp connection, played by the test
+struct SimPeer {
+  std::string inbox;      //everything the device has sent, consumed by the test
+  bool closed;            //the connection is gone
+  void (*onReceive)(SimPeer *peer, void *context); //called as data arrives
+  void *context;
+  SimLink *link;
+};
+
+extern SimStats simStats;
+
+SimPeer  *simConnect(uint16_t port);
+void      simListen(uint16_t port);
+SimPeer  *simAccepted(uint16_t port);
+void      simWrite(SimPeer *peer, const void *data, size_t length);
+void      simWrite(SimPeer *peer, const std::string &data);
+void      simClose(SimPeer *peer);
+
+bool      simStep( void );
+void      simRun( void );
+void      simAdvance(uint32_t ms);
+uint32_t  simNow( void );
+
+void      simFailSends(uint32_t count, sint8 error);
+void      simSetSegment(uint16_t size);
+void      simResetStats( void );
+
+int64_t   simHeapInUse( void );
+uint64_t  simHeapAllocs( void );
+
+std::string &simSerial( void );
+void      simSetSerialRoom(int room);
+
+#endif // _SIM_H_
@@ -0,0 +1,40 @@
+// createWsAcceptKey: the RFC 6455 sample, and random keys against the
+// peer's own SHA-1 and base64
+
+#include <stdlib.h>
+
+#include "easyWebSocket.cpp"
+#include "peer.h"
+#include "check.h"
+
+static const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int main() {
+  char accept[32];
+
+  //RFC 6455 section 1.3
+  CHECK_EQ(createWsAcceptKey("dGhlIHNhbXBsZSBub25jZQ==", accept, sizeof(accept)), 28);
+  CHECK(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+
+  //a 16 byte nonce always encodes to 22 characters and "=="
+  srand(1);
+  for (int round = 0; round < 100000; round++) {
+    char key[WS_KEY_LENGTH + 1];
+    for (int i = 0; i < 22; i++) {
+      key[i] = base64Alphabet[rand() % 64];
+    }
+    key[21] = base64Alphabet[(rand() % 4) * 16]; //the last character holds only 2 bits
+    strcpy(key + 22, "==");
+    CHECK_EQ(createWsAcceptKey(key, accept, 29), 28);
+    if (peerAcceptKey(key) != accept) {
+      CHECK(!"accept key differs from the peer's");
+      fprintf(stderr, "  key %s\n", key);
+      break;
+    }
+  }
+
+  //too small a buffer is refused, not overrun
+  CHECK_EQ(createWsAcceptKey("dGhlIHNhbXBsZSBub25jZQ==", accept, 28), -1);
+
+  return checkResult("test_acceptkey");
+}
@@ -0,0 +1,178 @@
+// base64: the RFC 4648 vectors, every character through the decode table,
+// random input against a bit-at-a-time reference decoder, and the
+// streaming calls fed in random pieces
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+extern "C" {
+#include "base64.h"
+}
+#include "check.h"
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//***********************************************************************
+// Decodes the way base64_decode is documented to: white space skipped,
+// '=' ends the input, anything else outside the alphabet or a lone final
+// character is an error.  Returns false on an error.
+static bool referenceDecode(const std::string &in, std::string *out) {
+  uint32_t bits = 0;
+  int bitCount = 0, characters = 0;
+
+  out->clear();
+  for (size_t i = 0; i < in.size(); i++) {
+    unsigned char c = in[i];
+    if (isspace(c)) {
+      continue;
+    }
+    if (c == '=') {
+      break;
+    }
+    const char *found = c != 0 ? strchr(alphabet, c) : NULL;
+    if (found == NULL) {
+      return false;
+    }
+    bits = (bits << 6) | (found - alphabet);
+    bitCount += 6;
+    characters++;
+    if (bitCount >= 8) {
+      bitCount -= 8;
+      *out += (char)(bits >> bitCount);
+    }
+  }
+  return characters % 4 != 1;
+}
+
+//***********************************************************************
+static std::string encode(const std::string &in) {
+  std::string out(BASE64_ENCODED_LENGTH(in.size()) + 1, '\0');
+  int length = base64_encode(in.size(), (const unsigned char *)in.data(), out.size(), &out[0]);
+  out.resize(length < 0 ? 0 : length);
+  return out;
+}
+
+//***********************************************************************
+// Decodes in one shot, false on an error.
+static bool decode(const std::string &in, std::string *out) {
+  out->assign(BASE64_DECODED_LENGTH(in.size()), '\0');
+  int length = base64_decode(in.size(), in.data(), out->size(), (unsigned char *)&(*out)[0]);
+  out->resize(length < 0 ? 0 : length);
+  return length >= 0;
+}
+
+//***********************************************************************
+// Decodes in pieces of random size, false on an error.
+static bool decodeStreaming(const std::string &in, std::string *out) {
+  base64_state state;
+  unsigned char buffer[BASE64_DECODED_LENGTH(64) + 3];
+  size_t done = 0;
+
+  out->clear();
+  base64_decode_init(&state);
+  while (done < in.size()) {
+    size_t piece = std::min((size_t)(rand() % 64), in.size() - done);
+    int length = base64_decode_update(&state, in.data() + done, piece, buffer);
+    if (length < 0) {
+      return false;
+    }
+    out->append((char *)buffer, length);
+    done += piece;
+  }
+  int length = base64_decode_final(&state, buffer);
+  if (length < 0) {
+    return false;
+  }
+  out->append((char *)buffer, length);
+  return true;
+}
+
+int main() {
+  std::string out;
+
+  //RFC 4648 section 10
+  const char *plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+  const char *encoded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+  for (int i = 0; i < 7; i++) {
+    CHECK(encode(plain[i]) == encoded[i]);
+    CHECK(decode(encoded[i], &out) && out == plain[i]);
+    CHECK(decodeStreaming(encoded[i], &out) && out == plain[i]);
+  }
+  char hash[29];
+  base64_encode20((const unsigned char *)"\xb3\x7a\x4f\x2c\xc0\x62\x4f\x16\x90\xf6\x46\x06\xcf\x38\x59\x45\xb2\xbe\xc4\xea", hash);
+  CHECK(strcmp(hash, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+
+  //each byte value in the last place of a group goes through the decode table
+  for (int c = 0; c < 256; c++) {
+    std::string in = "QUJD";
+    in[3] = (char)c;
+    std::string expected;
+    bool valid = referenceDecode(in, &expected);
+    CHECK_EQ(decode(in, &out), valid);
+    if (valid) {
+      CHECK(out == expected);
+    }
+  }
+
+  //random text, mostly alphabet with some white space, padding and junk
+  srand(1);
+  for (int round = 0; round < 200000; round++) {
+    std::string in;
+    int length = rand() % 80;
+    for (int i = 0; i < length; i++) {
+      int pick = rand() % 100;
+      in += pick < 90 ? alphabet[rand() % 64] : pick < 95 ? " \r\n\t"[rand() % 4] : pick < 98 ? '=' : (char)(rand() % 256);
+    }
+    std::string expected, streamed;
+    bool valid = referenceDecode(in, &expected);
+    bool decoded = decode(in, &out);
+    CHECK_EQ(decoded, valid);
+    CHECK_EQ(decodeStreaming(in, &streamed), valid);
+    if (valid && (out != expected || streamed != expected)) {
+      CHECK(!"decode differs from the reference");
+      fprintf(stderr, "  input \"%s\"\n", in.c_str());
+      break;
+    }
+  }
+
+  //random bytes round trip, encoded in one shot and streamed in pieces
+  for (int round = 0; round < 20000; round++) {
+    std::string in;
+    int length = rand() % 300;
+    for (int i = 0; i < length; i++) {
+      in += (char)rand();
+    }
+    std::string text = encode(in);
+    CHECK_EQ(text.size(), BASE64_ENCODED_LENGTH(in.size()));
+
+    base64_state state;
+    std::string streamed(BASE64_ENCODED_LENGTH(in.size() + 2) + 4, '\0');
+    size_t written = 0;
+    base64_encode_init(&state);
+    for (size_t done = 0; done < in.size(); ) {
+      size_t piece = std::min((size_t)(rand() % 20), in.size() - done);
+      written += base64_encode_update(&state, (const unsigned char *)in.data() + done, piece, &streamed[written]);
+      done += piece;
+    }
+    written += base64_encode_final(&state, &streamed[written]);
+    streamed.resize(written);
+    CHECK(streamed == text);
+
+    CHECK(decode(text, &out) && out == in);
+  }
+
+  //a buffer too small is a failure, not a truncation
+  char small[9];
+  CHECK_EQ(base64_encode(6, (const unsigned char *)"foobar", 8, small), -1);
+  CHECK_EQ(base64_encode(6, (const unsigned char *)"foobar", 9, small), 8);
+  CHECK(strcmp(small, "Zm9vYmFy") == 0);
+  unsigned char bytes[6];
+  CHECK_EQ(base64_decode(8, "Zm9vYmFy", 5, bytes), -1);
+  CHECK_EQ(base64_decode(8, "Zm9vYmFy", 6, bytes), 6);
+  CHECK_EQ(base64_decode(8, "Zm9vYg==", 3, bytes), -1);
+
+  return checkResult("test_base64");
+}
@@ -0,0 +1,101 @@
+// batched sends: frames packed into one transmit buffer, what is counted
+// when a batch can't be queued, and batches given up on
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9004
+
+static WebSocketServer<2, 512, 4> server(PORT);
+
+//***********************************************************************
+static uint32_t poolBlocksInUse( void ) {
+  uint32_t inUse = 0;
+  WSPoolStats stats;
+  for (uint8_t pool = 0; getWsPoolStats(pool, &stats); pool++) {
+    inUse += stats.inUse;
+  }
+  return inUse;
+}
+
+int main() {
+  PeerFrame frame;
+  WSBatch batch;
+  WSMetrics metrics;
+
+  server.begin();
+  int64_t heap = simHeapInUse();
+  SimPeer *peer = peerOpen(PORT);
+  CHECK(peer != NULL);
+  WSConnection *connection = &server.connections[0];
+
+  //three frames, one espconn_sent, each frame intact on the wire
+  simResetStats();
+  CHECK_EQ(beginWsBatch(&batch, connection), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "a", 1, OPCODE_TEXT), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "bb", 2, OPCODE_TEXT), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "ccc", 3, OPCODE_BINARY), WS_OK);
+  CHECK_EQ(flushWsBatch(&batch), WS_OK);
+  simRun();
+  CHECK_EQ(simStats.sentCalls, 1);
+  CHECK(peerRead(peer, &frame) && frame.opcode == OPCODE_TEXT && frame.payload == "a");
+  CHECK(peerRead(peer, &frame) && frame.opcode == OPCODE_TEXT && frame.payload == "bb");
+  CHECK(peerRead(peer, &frame) && frame.opcode == OPCODE_BINARY && frame.payload == "ccc");
+  CHECK(!peerRead(peer, &frame));
+
+#if WS_METRICS
+  getWsConnectionMetrics(connection, &metrics);
+  CHECK_EQ(metrics.framesOut[OPCODE_TEXT], 2);
+  CHECK_EQ(metrics.bytesOut[OPCODE_TEXT], 3);
+  CHECK_EQ(metrics.framesOut[OPCODE_BINARY], 1);
+#endif
+
+  //the queue fills up while a batch is being packed: the flush drops it,
+  //and none of its frames are counted
+  CHECK_EQ(beginWsBatch(&batch, connection), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "lost", 4, OPCODE_TEXT), WS_OK);
+  int queued = 0;
+  while (sendWsMessage(connection, "q", 1, OPCODE_TEXT) == WS_OK) {
+    queued++;
+  }
+  CHECK_EQ(flushWsBatch(&batch), WS_ERR_WOULD_BLOCK);
+#if WS_METRICS
+  getWsConnectionMetrics(connection, &metrics);
+  CHECK_EQ(metrics.framesOut[OPCODE_TEXT], 2 + queued);
+  CHECK_EQ(metrics.bytesOut[OPCODE_TEXT], 3 + queued);
+#endif
+  simRun();
+  int received = 0;
+  while (peerRead(peer, &frame)) {
+    CHECK(frame.payload == "q");
+    received++;
+  }
+  CHECK_EQ(received, queued);
+
+  //an aborted batch gives its buffer back, sends nothing and counts nothing
+#if WS_METRICS
+  getWsConnectionMetrics(connection, &metrics);
+  uint32_t textFrames = metrics.framesOut[OPCODE_TEXT];
+#endif
+  uint32_t blocks = poolBlocksInUse();
+  CHECK_EQ(beginWsBatch(&batch, connection), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "never", 5, OPCODE_TEXT), WS_OK);
+  CHECK(poolBlocksInUse() > blocks);
+  abortWsBatch(&batch);
+  CHECK_EQ(poolBlocksInUse(), blocks);
+  abortWsBatch(&batch);
+  CHECK_EQ(flushWsBatch(&batch), WS_ERR_MEM);
+  simRun();
+  CHECK(!peerRead(peer, &frame));
+#if WS_METRICS
+  getWsConnectionMetrics(connection, &metrics);
+  CHECK_EQ(metrics.framesOut[OPCODE_TEXT], textFrames);
+#endif
+
+  simClose(peer);
+  simRun();
+  CHECK_EQ(simHeapInUse(), heap);
+  return checkResult("test_batch");
+}
@@ -0,0 +1,87 @@
+// broadcast: one encoding shared by every connection's queue, and a
+// second, compressed one for the connections using permessage-deflate
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9006
+#define SLOTS 4
+
+static WebSocketServer<SLOTS, 512, 4> server(PORT);
+
+static uint16_t txBuffersInUse( void ) {
+  uint16_t inUse = 0;
+  WSPoolStats stats;
+  for (uint8_t pool = 0; getWsPoolStats(pool, &stats); pool++) {
+    inUse += stats.inUse;
+  }
+  return inUse;
+}
+
+int main() {
+  PeerFrame frame;
+  SimPeer *peers[SLOTS];
+
+  server.begin();
+  int64_t heap = simHeapInUse();
+  for (int i = 0; i < SLOTS; i++) {
+    peers[i] = peerOpen(PORT);
+    CHECK(peers[i] != NULL);
+  }
+
+  //one buffer, in flight on every connection at once
+  uint16_t inUse = txBuffersInUse();
+  server.broadcast("hello", 5, OPCODE_TEXT);
+  CHECK_EQ(txBuffersInUse(), inUse + 1);
+  for (int i = 1; i < SLOTS; i++) {
+    CHECK(server.connections[i].txInFlight == server.connections[0].txInFlight);
+  }
+  CHECK_EQ(server.connections[0].txInFlight->refCount, SLOTS);
+  simRun();
+  CHECK_EQ(txBuffersInUse(), inUse);
+  for (int i = 0; i < SLOTS; i++) {
+    CHECK(peerRead(peers[i], &frame) && frame.opcode == OPCODE_TEXT && frame.payload == "hello");
+    CHECK(!frame.masked && !frame.rsv1);
+  }
+
+  //queued behind a frame still in flight, the shared buffer is kept until
+  //the last connection has sent it
+  server.broadcast("first", 5, OPCODE_TEXT);
+  server.broadcast("second", 6, OPCODE_BINARY);
+  CHECK_EQ(txBuffersInUse(), inUse + 2);
+  simRun();
+  CHECK_EQ(txBuffersInUse(), inUse);
+  for (int i = 0; i < SLOTS; i++) {
+    CHECK(peerRead(peers[i], &frame) && frame.payload == "first");
+    CHECK(peerRead(peers[i], &frame) && frame.opcode == OPCODE_BINARY && frame.payload == "second");
+  }
+
+#if WS_DEFLATE
+  //a connection using permessage-deflate gets the compressed encoding, the
+  //others still share the plain one
+  simClose(peers[SLOTS - 1]);
+  simRun();
+  peers[SLOTS - 1] = peerOpen(PORT, "Sec-WebSocket-Extensions: permessage-deflate\r\n");
+  CHECK(peers[SLOTS - 1] != NULL);
+  std::string text(400, 'x');
+  server.broadcast(text.data(), text.size(), OPCODE_TEXT);
+  CHECK_EQ(txBuffersInUse(), inUse + 2);
+  simRun();
+  for (int i = 0; i < SLOTS - 1; i++) {
+    CHECK(peerRead(peers[i], &frame) && !frame.rsv1 && frame.payload == text);
+  }
+  CHECK(peerRead(peers[SLOTS - 1], &frame) && frame.rsv1 && frame.payload.size() < text.size());
+#endif
+
+  //nothing to send to, nothing allocated
+  for (int i = 0; i < SLOTS; i++) {
+    simClose(peers[i]);
+  }
+  simRun();
+  server.broadcast("nobody", 6, OPCODE_TEXT);
+  CHECK_EQ(txBuffersInUse(), inUse);
+  CHECK_EQ(simHeapInUse(), heap);
+  return checkResult("test_broadcast");
+}
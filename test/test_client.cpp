@@ -0,0 +1,171 @@
+// the client: against a library server, and against a peer playing the
+// server to check its requests and frames and to give it bad answers
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define SERVER_PORT 9009
+#define PEER_PORT 9010
+#define NOBODY_PORT 9011
+
+static const uint8_t ip[4] = { 10, 0, 0, 1 };
+static WebSocketServer<2, 2048, 4> server(SERVER_PORT);
+static WebSocketClient<512, 4> client;
+static std::string serverGot, clientGot;
+static int opened;
+
+static void onServerData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  serverGot.assign(payload, length);
+}
+
+static void onClientData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  clientGot.assign(payload, length);
+}
+
+static void onOpen( void ) {
+  opened++;
+}
+
+//***********************************************************************
+// Connects to the peer-played server and returns its end, with the
+// request read but not yet answered.
+static SimPeer *connectToPeer(std::string *request) {
+  CHECK_EQ(client.connect(ip, PEER_PORT, "collector", "/ingest"), ESPCONN_OK);
+  simRun();
+  SimPeer *peer = simAccepted(PEER_PORT);
+  CHECK(peer != NULL);
+  if (peer == NULL) {
+    return NULL;
+  }
+  *request = peerTakeRequest(peer);
+  return peer;
+}
+
+int main() {
+  PeerFrame frame;
+  std::string request;
+
+  server.setDataCallback(onServerData, NULL);
+  server.begin();
+  client.setDataCallback(onClientData, NULL);
+  client.setConnectionCallback(onOpen);
+  simListen(PEER_PORT);
+  int64_t heap = simHeapInUse();
+
+  //client and server both the library
+  CHECK_EQ(client.connect(ip, SERVER_PORT, "device", "/"), ESPCONN_OK);
+  CHECK_EQ(client.connect(ip, SERVER_PORT, "device", "/"), ESPCONN_ISCONN);
+  simRun();
+  CHECK(client.isOpen());
+  CHECK_EQ(opened, 1);
+  CHECK_EQ(server.countConnections(), 1);
+  CHECK_EQ(client.send("hello server", 12, OPCODE_TEXT), WS_OK);
+  simRun();
+  CHECK(serverGot == "hello server");
+  CHECK_EQ(sendWsMessage(&server.connections[0], "hello client", 12, OPCODE_TEXT), WS_OK);
+  simRun();
+  CHECK(clientGot == "hello client");
+
+  //a message larger than a segment, arriving in pieces
+  std::string large(1400, 'L');
+  simSetSegment(100);
+  CHECK_EQ(client.send(large.data(), large.size(), OPCODE_BINARY), WS_OK);
+  simRun();
+  CHECK(serverGot == large);
+  simSetSegment(SIM_MSS);
+
+  //closed from the client end: the server sees the close and lets the slot go
+  client.close();
+  simRun();
+  CHECK(!client.isOpen());
+  CHECK_EQ(server.countConnections(), 0);
+
+  //the request the client sends
+  SimPeer *peer = connectToPeer(&request);
+  CHECK(request.compare(0, 24, "GET /ingest HTTP/1.1\r\nHo") == 0);
+  CHECK(request.find("\r\nHost: collector\r\n") != std::string::npos);
+  CHECK(request.find("\r\nUpgrade: websocket\r\n") != std::string::npos);
+  CHECK(request.find("\r\nConnection: Upgrade\r\n") != std::string::npos);
+  CHECK(request.find("\r\nSec-WebSocket-Version: 13\r\n") != std::string::npos);
+  size_t key = request.find("\r\nSec-WebSocket-Key: ");
+  CHECK(key != std::string::npos && request.compare(key + 21 + 22, 4, "==\r\n") == 0);
+  CHECK(!client.isOpen());
+
+  //the response split over several segments, then frames both ways
+  std::string response = peerResponse(request);
+  simWrite(peer, response.substr(0, 10));
+  simRun();
+  CHECK(!client.isOpen());
+  simWrite(peer, response.substr(10));
+  simRun();
+  CHECK(client.isOpen());
+  CHECK_EQ(opened, 2);
+
+  CHECK_EQ(client.send("masked", 6, OPCODE_TEXT), WS_OK);
+  simRun();
+  CHECK(peerRead(peer, &frame) && frame.masked && frame.fin && frame.opcode == OPCODE_TEXT && frame.payload == "masked");
+
+  WSBatch batch;
+  CHECK_EQ(beginWsBatch(&batch, client.connection()), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "one", 3, OPCODE_TEXT), WS_OK);
+  CHECK_EQ(appendWsBatch(&batch, "two", 3, OPCODE_TEXT), WS_OK);
+  CHECK_EQ(flushWsBatch(&batch), WS_OK);
+  simRun();
+  CHECK(peerRead(peer, &frame) && frame.masked && frame.payload == "one");
+  CHECK(peerRead(peer, &frame) && frame.masked && frame.payload == "two");
+
+  simWrite(peer, peerEncode(OPCODE_TEXT, "from the server", false));
+  simRun();
+  CHECK(clientGot == "from the server");
+  simWrite(peer, peerEncode(OPCODE_PING, "hb", false));
+  simRun();
+  CHECK(peerRead(peer, &frame) && frame.masked && frame.opcode == OPCODE_PONG && frame.payload == "hb");
+
+  //a server must not mask its frames
+  simWrite(peer, peerEncode(OPCODE_TEXT, "masked by the server", true));
+  simRun();
+  CHECK(!client.isOpen());
+  CHECK(clientGot == "from the server");
+  simRun();
+  CHECK(peer->closed);
+
+  //answers the client must not go along with
+  const char *bad[] = {
+    "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n",
+    "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: AAAAAAAAAAAAAAAAAAAAAAAAAAA=\r\n\r\n",
+    NULL,                   //right accept key, an extension we didn't ask for
+    NULL,                   //right accept key, no Upgrade header
+  };
+  for (int i = 0; i < 4; i++) {
+    peer = connectToPeer(&request);
+    if (peer == NULL) {
+      break;
+    }
+    std::string answer = bad[i] != NULL ? bad[i] :
+                         i == 2 ? peerResponse(request, "Sec-WebSocket-Extensions: permessage-deflate\r\n") :
+                         "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " +
+                         peerAcceptKey(request.substr(request.find("Sec-WebSocket-Key: ") + 19, 24)) + "\r\n\r\n";
+    simWrite(peer, answer);
+    simRun();
+    CHECK(!client.isOpen());
+    CHECK(peer->closed);
+    CHECK_EQ(opened, 2);
+  }
+
+  //nobody listening: the reset frees the slot for another try
+  CHECK_EQ(client.connect(ip, NOBODY_PORT, "nobody", "/"), ESPCONN_OK);
+  simRun();
+  CHECK(!client.isOpen());
+  CHECK_EQ(client.connect(ip, SERVER_PORT, "device", "/"), ESPCONN_OK);
+  simRun();
+  CHECK(client.isOpen());
+  CHECK_EQ(opened, 3);
+  client.close();
+  simRun();
+
+  CHECK_EQ(simHeapInUse(), heap);
+  return checkResult("test_client");
+}
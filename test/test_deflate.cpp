@@ -0,0 +1,170 @@
+// permessage-deflate against zlib: what wsdeflate_compress produces is
+// inflated by zlib with the negotiated window, what zlib produces at every
+// level and strategy is inflated by wsdeflate_inflate, and the same holds
+// end to end through a server connection
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <string>
+
+#include "easyWebSocket.h"
+#include "wsdeflate.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9007
+#define RX_BUFFER_SIZE 4096
+
+static WebSocketServer<2, RX_BUFFER_SIZE, 4> server(PORT);
+static std::string received;
+static uint16_t work[WSDEFLATE_WORK_WORDS(15, 9)];
+
+//***********************************************************************
+// A message payload as RFC 7692 has it, without the 00 00 ff ff that
+// ends a sync flush; inflated by zlib with a window of 2^windowBits.
+static bool zlibInflate(const std::string &payload, int windowBits, std::string *out) {
+  std::string in = payload + std::string("\0\0\xff\xff", 4);
+  uint8_t buffer[65536 + 16];
+  z_stream stream;
+
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, -windowBits) != Z_OK) {
+    return false;
+  }
+  stream.next_in = (Bytef *)in.data();
+  stream.avail_in = in.size();
+  stream.next_out = buffer;
+  stream.avail_out = sizeof(buffer);
+  int result = inflate(&stream, Z_SYNC_FLUSH);
+  out->assign((char *)buffer, sizeof(buffer) - stream.avail_out);
+  bool ok = (result == Z_OK || result == Z_STREAM_END) && stream.avail_in == 0;
+  inflateEnd(&stream);
+  return ok;
+}
+
+//***********************************************************************
+// Compressed by zlib and sync flushed, with the 00 00 ff ff taken off.
+static std::string zlibDeflate(const std::string &in, int level, int strategy, int windowBits) {
+  uint8_t buffer[65536 + 1024];
+  z_stream stream;
+
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, level, Z_DEFLATED, -windowBits, 8, strategy);
+  stream.next_in = (Bytef *)in.data();
+  stream.avail_in = in.size();
+  stream.next_out = buffer;
+  stream.avail_out = sizeof(buffer);
+  deflate(&stream, Z_SYNC_FLUSH);
+  std::string out((char *)buffer, sizeof(buffer) - stream.avail_out - 4);
+  deflateEnd(&stream);
+  return out;
+}
+
+//***********************************************************************
+// Random bytes, a small alphabet, or JSON telemetry.
+static std::string makeInput(size_t length, int kind) {
+  static const char *tokens[] = { "{\"sensor\":", "\"temp\":", "\"humidity\":", ",\"id\":", "}", "[", "]",
+                                  "\"ok\"", "true", "false", "null", "," };
+  std::string in;
+  while (in.size() < length) {
+    if (kind == 0) {
+      in += (char)rand();
+    } else if (kind == 1) {
+      in += (char)('a' + rand() % 3);
+    } else {
+      in += tokens[rand() % 12];
+      if (rand() % 3 == 0) {
+        in += (char)('0' + rand() % 10);
+      }
+    }
+  }
+  in.resize(length);
+  return in;
+}
+
+//***********************************************************************
+static void onData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  received.assign(payload, length);
+}
+
+int main() {
+  std::string out;
+  uint8_t compressed[65536 + 1024], inflated[65536];
+
+  srand(1);
+  for (int round = 0; round < 20000; round++) {
+    size_t length = round % 500 == 0 ? rand() % WSDEFLATE_MAX_INPUT : rand() % 3000;
+    int kind = rand() % 3;
+    uint8_t windowBits = 8 + rand() % 8, memLevel = 1 + rand() % 8;
+    std::string in = makeInput(length, kind);
+
+    //ours, inflated by zlib within the window we said we'd use; zlib
+    //doesn't take a raw window smaller than 2^9
+    int32_t compressedLength = wsdeflate_compress((const uint8_t *)in.data(), in.size(), compressed,
+                                                  in.size() + in.size() / 8 + 16, windowBits, memLevel, work);
+    CHECK(compressedLength >= 0);
+    std::string ours((char *)compressed, compressedLength < 0 ? 0 : compressedLength);
+    CHECK(zlibInflate(ours, windowBits < 9 ? 9 : windowBits, &out) && out == in);
+
+    //and by ourselves, refusing to overrun a buffer one byte short
+    CHECK_EQ(wsdeflate_inflate((const uint8_t *)ours.data(), ours.size(), inflated, in.size()), (int32_t)in.size());
+    CHECK(memcmp(inflated, in.data(), in.size()) == 0);
+    if (!in.empty()) {
+      CHECK_EQ(wsdeflate_inflate((const uint8_t *)ours.data(), ours.size(), inflated, in.size() - 1), -1);
+    }
+
+    //zlib's, stored, fixed and dynamic blocks
+    static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FIXED, Z_HUFFMAN_ONLY, Z_RLE };
+    std::string theirs = zlibDeflate(in, rand() % 10, strategies[rand() % 4], 9 + rand() % 7);
+    CHECK_EQ(wsdeflate_inflate((const uint8_t *)theirs.data(), theirs.size(), inflated, sizeof(inflated)), (int32_t)in.size());
+    CHECK(memcmp(inflated, in.data(), in.size()) == 0);
+
+    //damaged input fails or decodes to something, without reading or
+    //writing out of bounds
+    if (!theirs.empty()) {
+      theirs[rand() % theirs.size()] ^= 1 << (rand() % 8);
+      wsdeflate_inflate((const uint8_t *)theirs.data(), theirs.size(), inflated, 3000);
+    }
+
+    if (checkFailures) {
+      fprintf(stderr, "  round %d length %u kind %d windowBits %u memLevel %u\n",
+              round, (unsigned)length, kind, windowBits, memLevel);
+      return checkResult("test_deflate");
+    }
+  }
+
+#if WS_DEFLATE
+  //end to end: the peer offers a 2^9 window, which the server takes
+  std::string response;
+  server.setDataCallback(onData, NULL);
+  server.begin();
+  SimPeer *peer = simConnect(PORT);
+  CHECK(peerHandshake(peer, "Sec-WebSocket-Extensions: permessage-deflate; server_max_window_bits=9\r\n", &response));
+  CHECK(response.find("permessage-deflate; server_no_context_takeover; client_no_context_takeover; server_max_window_bits=9") != std::string::npos);
+
+  //a message compressed by zlib is delivered inflated
+  std::string json = makeInput(2000, 2);
+  simWrite(peer, peerEncode(OPCODE_TEXT, zlibDeflate(json, 6, Z_DEFAULT_STRATEGY, 15), true, true, true));
+  simRun();
+  CHECK(received == json);
+
+  //a message from the server arrives compressed, within the window
+  PeerFrame frame;
+  sendWsMessage(&server.connections[0], json.data(), json.size(), OPCODE_TEXT);
+  simRun();
+  CHECK(peerRead(peer, &frame) && frame.rsv1 && frame.opcode == OPCODE_TEXT);
+  CHECK(frame.payload.size() < json.size());
+  CHECK(zlibInflate(frame.payload, 9, &out) && out == json);
+
+  //one too small to be worth it goes as it is
+  sendWsMessage(&server.connections[0], "{}", 2, OPCODE_TEXT);
+  simRun();
+  CHECK(peerRead(peer, &frame) && !frame.rsv1 && frame.payload == "{}");
+  simClose(peer);
+  simRun();
+#endif
+
+  return checkResult("test_deflate");
+}
@@ -0,0 +1,81 @@
+// end to end through the simulator: handshake, echo, ping, keepalive and
+// close, with the heap back where it started afterwards
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9000
+
+static WebSocketServer<4, 1460, 8> server(PORT);
+
+static void onData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  sendWsMessage(connection, payload, length, opcode);
+}
+
+int main() {
+  PeerFrame frame;
+
+  server.setDataCallback(onData, NULL);
+  server.begin();
+  int64_t heap = simHeapInUse();
+
+  //a request without a key is turned away
+  SimPeer *bad = simConnect(PORT);
+  simWrite(bad, std::string("GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n\r\n"));
+  simRun();
+  CHECK(bad->inbox.compare(0, 12, "HTTP/1.1 400") == 0);
+  CHECK(bad->closed);
+
+  SimPeer *peer = peerOpen(PORT);
+  CHECK(peer != NULL);
+  CHECK_EQ(server.countConnections(), 1);
+
+  //text and binary come back as they went, a long one in several segments
+  peerSend(peer, OPCODE_TEXT, "hello");
+  simRun();
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.fin && !frame.masked && frame.opcode == OPCODE_TEXT && frame.payload == "hello");
+
+  std::string big(1400, 'x');
+  for (size_t i = 0; i < big.size(); i++) {
+    big[i] = (char)(i * 7);
+  }
+  simSetSegment(100);
+  peerSend(peer, OPCODE_BINARY, big);
+  simRun();
+  simSetSegment(SIM_MSS);
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.opcode == OPCODE_BINARY && frame.payload == big);
+
+  //a ping is answered with its payload
+  peerSend(peer, OPCODE_PING, "are you there");
+  simRun();
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.opcode == OPCODE_PONG && frame.payload == "are you there");
+
+  //a close is answered with a close, and the connection goes
+  peerSend(peer, OPCODE_CLOSE, "");
+  simRun();
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.opcode == OPCODE_CLOSE);
+  simAdvance(WS_CLOSE_TIMEOUT * WS_TIMER_TICK);
+  CHECK(peer->closed);
+  CHECK_EQ(server.countConnections(), 0);
+
+  //the keepalive pings an idle connection, and drops it once the pings go
+  //unanswered
+  SimPeer *silent = peerOpen(PORT);
+  CHECK(silent != NULL);
+  simAdvance(WS_PING_INTERVAL * WS_TIMER_TICK);
+  CHECK(peerRead(silent, &frame));
+  CHECK(frame.opcode == OPCODE_PING);
+  CHECK(!silent->closed);
+  simAdvance((WS_PING_MAX_MISSED + 1) * WS_PING_INTERVAL * WS_TIMER_TICK);
+  CHECK(silent->closed);
+  CHECK_EQ(server.countConnections(), 0);
+
+  CHECK_EQ(simHeapInUse(), heap);
+  return checkResult("test_echo");
+}
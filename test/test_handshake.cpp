@@ -0,0 +1,70 @@
+// the upgrade request parser: what is accepted, and what is refused with
+// which status
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9002
+#define PLAIN_PORT 9012
+
+static WebSocketServer<2, 256, 4> server(PORT);
+static WebSocketServer<1, 256, 2> plainServer(PLAIN_PORT); //no origin callback, no protocol
+static std::string originSeen;
+
+static bool onOrigin(const char *origin, uint8_t length) {
+  originSeen.assign(origin, length);
+  return originSeen == "https://device.local";
+}
+
+//***********************************************************************
+// The status line the server answers extraHeaders with.
+static std::string answer(const char *extraHeaders, uint16_t port = PORT) {
+  SimPeer *peer = simConnect(port);
+  std::string response;
+  peerHandshake(peer, extraHeaders, &response);
+  simClose(peer);
+  simRun();
+  return response.substr(0, response.find("\r\n"));
+}
+
+int main() {
+  server.setOriginCallback(onOrigin);
+  server.setProtocol("chat");
+  server.begin();
+  plainServer.begin();
+
+  CHECK(answer("Origin: https://device.local\r\n") == "HTTP/1.1 101 Switching Protocols");
+  CHECK(answer("Origin: https://evil.example\r\n") == "HTTP/1.1 403 Forbidden");
+
+  //an origin over WS_HANDSHAKE_MAX_VALUE whose first bytes are the allowed
+  //one, which is never shown to onOrigin cut short
+  std::string longOrigin = "Origin: https://device.local" + std::string(WS_HANDSHAKE_MAX_VALUE, 'x') + "\r\n";
+  originSeen.clear();
+  CHECK(answer(longOrigin.c_str()) == "HTTP/1.1 400 Bad Request");
+  CHECK(originSeen.empty());
+
+  //the same for a protocol list that only names ours beyond the limit,
+  //and one exactly at the limit, which is still fine
+  std::string longProtocol = "Sec-WebSocket-Protocol: " + std::string(WS_HANDSHAKE_MAX_VALUE - 4, 'p') + ", chat\r\n";
+  CHECK(answer(longProtocol.c_str()) == "HTTP/1.1 400 Bad Request");
+  std::string fullProtocol = "Sec-WebSocket-Protocol: " + std::string(WS_HANDSHAKE_MAX_VALUE - 6, 'p') + ",chat\r\n";
+  CHECK(answer(fullProtocol.c_str()) == "HTTP/1.1 101 Switching Protocols");
+
+  //a long extensions offer is only declined
+  std::string longExtensions = "Sec-WebSocket-Extensions: permessage-deflate; " + std::string(WS_HANDSHAKE_MAX_VALUE, ' ') + "x\r\n";
+  CHECK(answer(longExtensions.c_str()) == "HTTP/1.1 101 Switching Protocols");
+
+  //a server that checks neither just skips them, however long
+  CHECK(answer(longOrigin.c_str(), PLAIN_PORT) == "HTTP/1.1 101 Switching Protocols");
+  CHECK(answer(longProtocol.c_str(), PLAIN_PORT) == "HTTP/1.1 101 Switching Protocols");
+  std::string response;
+  SimPeer *peer = simConnect(PLAIN_PORT);
+  CHECK(peerHandshake(peer, longProtocol.c_str(), &response));
+  CHECK(response.find("Sec-WebSocket-Protocol") == std::string::npos);
+  simClose(peer);
+  simRun();
+
+  return checkResult("test_handshake");
+}
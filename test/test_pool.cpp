@@ -0,0 +1,141 @@
+// the transmit buffer pools: a pool against a shadow of what it has handed
+// out over millions of allocations, then a server sending a million
+// messages of every size, with the heap back where it started each time
+// the queues drain
+
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+
+#include "easyWebSocket.h"
+#include "wspool.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9008
+#define BLOCK_SIZE 40
+#define BLOCK_COUNT 50
+#define MESSAGES 1000000
+
+static WebSocketServer<4, 256, 8> server(PORT);
+static uint32_t storage[WSPOOL_STORAGE_WORDS(BLOCK_SIZE, BLOCK_COUNT)];
+
+//***********************************************************************
+static void checkPool( void ) {
+  WSPool pool;
+  std::set<uint8_t *> held;
+  uint32_t failures = 0;
+  uint16_t highWater = 0;
+
+  wspool_init(&pool, storage, BLOCK_SIZE, BLOCK_COUNT);
+  for (int op = 0; op < 2000000; op++) {
+    if (rand() % 2 == 0 || held.size() == BLOCK_COUNT) {
+      uint8_t *block = (uint8_t *)wspool_alloc(&pool);
+      if (held.size() == BLOCK_COUNT) {
+        CHECK(block == NULL);
+        failures++;
+        continue;
+      }
+      CHECK(block != NULL && wspool_owns(&pool, block));
+      CHECK(((uintptr_t)block & (sizeof(void *) - 1)) == 0);
+      CHECK(held.insert(block).second);
+      //fill it, so an overlap with another block shows up when that is freed
+      memset(block, (uint8_t)(uintptr_t)block, BLOCK_SIZE);
+      if (held.size() > highWater) {
+        highWater = held.size();
+      }
+    } else if (!held.empty()) {
+      std::set<uint8_t *>::iterator it = held.begin();
+      std::advance(it, rand() % held.size());
+      uint8_t *block = *it;
+      for (int i = 0; i < BLOCK_SIZE; i++) {
+        if (block[i] != (uint8_t)(uintptr_t)block) {
+          CHECK(!"a block was written through another");
+          return;
+        }
+      }
+      wspool_free(&pool, block);
+      held.erase(it);
+    }
+    CHECK_EQ(pool.stats.inUse, held.size());
+    if (checkFailures) {
+      return;
+    }
+  }
+  CHECK_EQ(pool.stats.highWater, highWater);
+  CHECK_EQ(pool.stats.failures, failures);
+  CHECK(!wspool_owns(&pool, storage + WSPOOL_STORAGE_WORDS(BLOCK_SIZE, BLOCK_COUNT)));
+  CHECK(!wspool_owns(&pool, storage - 1));
+}
+
+//***********************************************************************
+static uint32_t poolBlocksInUse( void ) {
+  uint32_t inUse = 0;
+  WSPoolStats stats;
+  for (uint8_t pool = 0; getWsPoolStats(pool, &stats); pool++) {
+    inUse += stats.inUse;
+  }
+  return inUse;
+}
+
+int main() {
+  SimPeer *peers[4];
+  std::string payload(WS_POOL_LARGE_SIZE + 500, 'p');
+
+  srand(1);
+  checkPool();
+
+  server.begin();
+  for (int i = 0; i < 4; i++) {
+    peers[i] = peerOpen(PORT);
+  }
+  int64_t heap = simHeapInUse();
+  uint64_t allocs = simHeapAllocs();
+  uint32_t sent = 0, refused = 0, drains = 0;
+
+  //sizes from empty to past the largest block, so the heap fallback is
+  //used as well as every pool; drained at random, so queues are sometimes
+  //full and sends refused
+  while (sent + refused < MESSAGES) {
+    WSConnection *connection = &server.connections[rand() % 4];
+    uint32_t length = rand() % payload.size();
+    if (rand() % 4 == 0) {
+      length %= WS_POOL_SMALL_SIZE;
+    }
+    if (sendWsMessage(connection, payload.data(), length, OPCODE_BINARY) == WS_OK) {
+      sent++;
+    } else {
+      refused++;
+    }
+    if (rand() % 16 == 0) {
+      simRun();
+      for (int i = 0; i < 4; i++) {
+        peers[i]->inbox.clear();
+      }
+      drains++;
+      if (poolBlocksInUse() != 0 || simHeapInUse() != heap) {
+        CHECK(!"buffers left over once the queues drained");
+        break;
+      }
+    }
+  }
+  simRun();
+  CHECK_EQ(poolBlocksInUse(), 0);
+  CHECK_EQ(simHeapInUse(), heap);
+  CHECK(simHeapAllocs() > allocs);   //the fallback was used
+  CHECK(sent > MESSAGES / 2);
+
+  WSPoolStats stats;
+  for (uint8_t pool = 0; getWsPoolStats(pool, &stats); pool++) {
+    CHECK(stats.highWater > 0);
+  }
+  printf("test_pool: %u messages sent, %u refused, %u drains, %llu heap allocations\n",
+         (unsigned)sent, (unsigned)refused, (unsigned)drains, (unsigned long long)(simHeapAllocs() - allocs));
+
+  for (int i = 0; i < 4; i++) {
+    simClose(peers[i]);
+  }
+  simRun();
+  return checkResult("test_pool");
+}
@@ -0,0 +1,92 @@
+// publish/subscribe: topics on a server with more slots than a word has
+// bits, and subscription messages only when the server allows them
+
+#define WS_RAM_BUDGET (1 << 20) //40 slots, more than a device would have
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9005
+#define SLOTS 40
+
+static WebSocketServer<SLOTS, 128, 4> server(PORT);
+static std::string passedOn;
+
+static void onData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  passedOn.assign(payload, length);
+}
+
+int main() {
+  PeerFrame frame;
+  SimPeer *peers[SLOTS];
+
+  server.setDataCallback(onData, NULL);
+  server.begin();
+  int8_t news = server.addTopic("news");
+  int8_t weather = server.addTopic("weather");
+  CHECK(news != WS_NO_TOPIC && weather != WS_NO_TOPIC && news != weather);
+  CHECK_EQ(server.addTopic("news"), news);
+
+  for (int i = 0; i < SLOTS; i++) {
+    peers[i] = peerOpen(PORT);
+    CHECK(peers[i] != NULL);
+  }
+  CHECK_EQ(server.countConnections(), SLOTS);
+
+  //slots either side of the word boundary, and the last one
+  subscribeWsTopic(&server.connections[31], news);
+  subscribeWsTopic(&server.connections[32], news);
+  subscribeWsTopic(&server.connections[39], news);
+  subscribeWsTopic(&server.connections[5], weather);
+  server.publish(news, "headline", 8, OPCODE_TEXT);
+  simRun();
+  for (int i = 0; i < SLOTS; i++) {
+    bool subscribed = (i == 31 || i == 32 || i == 39);
+    CHECK_EQ(peerRead(peers[i], &frame), subscribed);
+    if (subscribed) {
+      CHECK(frame.payload == "headline");
+    }
+  }
+
+  unsubscribeWsTopic(&server.connections[32], news);
+  server.publish(news, "update", 6, OPCODE_TEXT);
+  simRun();
+  CHECK(peerRead(peers[31], &frame) && frame.payload == "update");
+  CHECK(!peerRead(peers[32], &frame));
+  CHECK(peerRead(peers[39], &frame) && frame.payload == "update");
+
+  //without setSubscriptionMessages a subscribe message is just a message
+  peerSend(peers[0], OPCODE_TEXT, WS_SUBSCRIBE "weather");
+  simRun();
+  CHECK(passedOn == WS_SUBSCRIBE "weather");
+  server.publish(weather, "rain", 4, OPCODE_TEXT);
+  simRun();
+  CHECK(!peerRead(peers[0], &frame));
+  CHECK(peerRead(peers[5], &frame) && frame.payload == "rain");
+
+  //with it, the message subscribes and goes no further
+  server.setSubscriptionMessages(true);
+  passedOn.clear();
+  peerSend(peers[0], OPCODE_TEXT, WS_SUBSCRIBE "weather");
+  peerSend(peers[5], OPCODE_TEXT, WS_UNSUBSCRIBE "weather");
+  simRun();
+  CHECK(passedOn.empty());
+  server.publish(weather, "sun", 3, OPCODE_TEXT);
+  simRun();
+  CHECK(peerRead(peers[0], &frame) && frame.payload == "sun");
+  CHECK(!peerRead(peers[5], &frame));
+
+  //a slot's subscriptions go with its connection
+  simClose(peers[31]);
+  simRun();
+  SimPeer *next = peerOpen(PORT);
+  CHECK(next != NULL);
+  server.publish(news, "later", 5, OPCODE_TEXT);
+  simRun();
+  CHECK(!peerRead(next, &frame));
+  CHECK(peerRead(peers[39], &frame) && frame.payload == "later");
+
+  return checkResult("test_pubsub");
+}
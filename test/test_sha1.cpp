@@ -0,0 +1,107 @@
+// SHA-1 against the FIPS 180 and RFC 3174 vectors, written whole, a byte
+// at a time and in uneven pieces, and HMAC-SHA1 against RFC 2202.  Built
+// twice, with the unrolled compression and with SHA1_SMALL.
+
+#include <string.h>
+#include <string>
+
+extern "C" {
+#include "sha1.h"
+}
+#include "check.h"
+
+//***********************************************************************
+static std::string hex(const uint8_t *bytes, int length) {
+  static const char digits[] = "0123456789abcdef";
+  std::string out;
+  for (int i = 0; i < length; i++) {
+    out += digits[bytes[i] >> 4];
+    out += digits[bytes[i] & 15];
+  }
+  return out;
+}
+
+//***********************************************************************
+// Hashes message in pieces of the given size, 0 for one sha1_write.
+static std::string hash(const std::string &message, size_t piece) {
+  sha1nfo s;
+  sha1_init(&s);
+  if (piece == 0) {
+    sha1_write(&s, message.data(), message.size());
+  } else {
+    for (size_t done = 0; done < message.size(); done += piece) {
+      sha1_write(&s, message.data() + done, std::min(piece, message.size() - done));
+    }
+  }
+  return hex(sha1_result(&s), HASH_LENGTH);
+}
+
+//***********************************************************************
+static std::string hmac(const std::string &key, const std::string &message) {
+  sha1nfo s;
+  sha1_initHmac(&s, (const uint8_t *)key.data(), key.size());
+  sha1_write(&s, message.data(), message.size());
+  return hex(sha1_resultHmac(&s), HASH_LENGTH);
+}
+
+int main() {
+  struct { std::string message; const char *digest; } vectors[] = {
+    { "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+    { "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+    { "The quick brown fox jumps over the lazy dog", "2fd4e1c67a2d28fced849ee1bb76e7391b93eb12" },
+    { std::string(1000000, 'a'), "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+  };
+  const size_t pieces[] = { 0, 1, 3, 63, 64, 65, 1000 };
+
+  for (unsigned v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+    for (unsigned p = 0; p < sizeof(pieces) / sizeof(pieces[0]); p++) {
+      CHECK(hash(vectors[v].message, pieces[p]) == vectors[v].digest);
+    }
+  }
+
+  //RFC 3174 test 4, 80 times a 64 byte string, mixing the byte and block paths
+  sha1nfo s;
+  sha1_init(&s);
+  for (int i = 0; i < 10; i++) {
+    for (int j = 0; j < 8; j++) {
+      if (j & 1) {
+        for (const char *c = "01234567"; *c; c++) {
+          sha1_writebyte(&s, *c);
+        }
+      } else {
+        sha1_write(&s, "01234567", 8);
+      }
+    }
+  }
+  CHECK(hex(sha1_result(&s), HASH_LENGTH) == "dea356a2cddd90c7a7ecedc5ebb563934f460452");
+
+  //every length across the block and padding boundaries, whole against bytewise
+  std::string message;
+  for (int length = 0; length < 200; length++) {
+    sha1_init(&s);
+    for (int i = 0; i < length; i++) {
+      sha1_writebyte(&s, message[i]);
+    }
+    CHECK(hex(sha1_result(&s), HASH_LENGTH) == hash(message, 0));
+    message += (char)(length * 7 + 1);
+  }
+
+  //RFC 2202 section 3
+  CHECK(hmac(std::string(20, '\x0b'), "Hi There") == "b617318655057264e28bc0b6fb378c8ef146be00");
+  CHECK(hmac("Jefe", "what do ya want for nothing?") == "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79");
+  CHECK(hmac(std::string(20, '\xaa'), std::string(50, '\xdd')) == "125d7342b9ac11cd91a39af48aa17b4f63f175d3");
+  CHECK(hmac(std::string("\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19", 25),
+             std::string(50, '\xcd')) == "4c9007f4026250c6bc8414f9bf50c86c2d7235da");
+  CHECK(hmac(std::string(20, '\x0c'), "Test With Truncation") == "4c1a03424b55e07fe7f27be1d58bb9324a9a5a04");
+  CHECK(hmac(std::string(80, '\xaa'), "Test Using Larger Than Block-Size Key - Hash Key First") ==
+        "aa4ae5e15272d00e95705637ce8a3b55ed402112");
+  CHECK(hmac(std::string(80, '\xaa'), "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data") ==
+        "e8e99d0f45237d786d6bbaa7965c7808bbff1a91");
+
+#ifdef SHA1_SMALL
+  return checkResult("test_sha1 (SHA1_SMALL)");
+#else
+  return checkResult("test_sha1");
+#endif
+}
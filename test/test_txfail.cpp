@@ -0,0 +1,115 @@
+// espconn_sent refusing data: nothing already accepted by sendWsMessage may
+// be lost, the queue has to start moving again by itself, and a broken
+// connection must never see part of a frame followed by another frame
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9001
+
+static WebSocketServer<2, 512, 8> server(PORT);
+static int handedBack;
+
+static void onSent(const char *payload, void *context) {
+  handedBack++;
+}
+
+int main() {
+  PeerFrame frame;
+
+  server.begin();
+  int64_t heap = simHeapInUse();
+  SimPeer *peer = peerOpen(PORT);
+  CHECK(peer != NULL);
+  WSConnection *connection = &server.connections[0];
+
+  //the first send is refused and nothing else happens on the connection:
+  //the timer gets it out
+  simFailSends(1, ESPCONN_MEM);
+  CHECK_EQ(sendWsMessage(connection, "lonely", 6, OPCODE_TEXT), WS_OK);
+  simRun();
+  CHECK(peer->inbox.empty());
+  simAdvance(WS_TIMER_TICK);
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.opcode == OPCODE_TEXT && frame.payload == "lonely");
+
+  //frames coalesced behind a refused send all arrive, in order, once
+  //queueing more retries it
+  simFailSends(3, ESPCONN_MAXNUM);
+  const char *words[] = { "one", "two", "three", "four", "five" };
+  for (int i = 0; i < 5; i++) {
+    CHECK_EQ(sendWsMessage(connection, words[i], strlen(words[i]), OPCODE_TEXT), WS_OK);
+  }
+  simRun();
+  simAdvance(WS_TIMER_TICK);
+  for (int i = 0; i < 5; i++) {
+    CHECK(peerRead(peer, &frame));
+    CHECK(frame.payload == words[i]);
+  }
+  CHECK(!peerRead(peer, &frame));
+  CHECK_EQ(simStats.refused, 4);
+
+  //data arriving on the connection retries too
+  simFailSends(1, ESPCONN_MEM);
+  sendWsMessage(connection, "echo", 4, OPCODE_TEXT);
+  peerSend(peer, OPCODE_PONG, "");
+  simRun();
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.payload == "echo");
+
+#if WS_METRICS
+  WSMetrics metrics;
+  getWsConnectionMetrics(connection, &metrics);
+  CHECK_EQ(metrics.sentFailures, 5);
+#endif
+
+  //a borrowed payload's header refused for now: it still goes first
+  std::string big(3000, 'z');
+  simFailSends(1, ESPCONN_MEM);
+  CHECK_EQ(sendWsMessageNoCopy(connection, big.data(), big.size(), OPCODE_BINARY, onSent, NULL), WS_OK);
+  simRun();
+  simAdvance(WS_TIMER_TICK);
+  CHECK((uint8_t)peer->inbox[0] == (FLAG_FIN | OPCODE_BINARY));
+  CHECK(peerRead(peer, &frame));
+  CHECK(frame.opcode == OPCODE_BINARY && frame.payload == big);
+  CHECK_EQ(handedBack, 1);
+
+  simClose(peer);
+  simRun();
+
+  //the header refused because the connection is broken: nothing of the
+  //frame goes out, and as the send failed the payload was never lent
+  peer = peerOpen(PORT);
+  CHECK(peer != NULL);
+  simFailSends(1, ESPCONN_CONN);
+  CHECK(sendWsMessageNoCopy(connection, big.data(), big.size(), OPCODE_BINARY, onSent, NULL) == WS_ERR_CLOSED);
+  CHECK_EQ(handedBack, 1);
+  simRun();
+  CHECK(peer->inbox.empty());
+  CHECK(peer->closed);
+  CHECK_EQ(server.countConnections(), 0);
+
+  //broken halfway through the payload: the connection goes, and the frame
+  //after it is refused rather than sent on the end of a partial one
+  peer = peerOpen(PORT);
+  CHECK(peer != NULL);
+  CHECK_EQ(sendWsMessageNoCopy(connection, big.data(), big.size(), OPCODE_BINARY, onSent, NULL), WS_OK);
+  CHECK_EQ(sendWsMessage(connection, "after", 5, OPCODE_TEXT), WS_OK);
+  simStep();          //the header arrives, the payload's first segment is sent
+  simFailSends(1, ESPCONN_CONN);
+  simRun();
+  CHECK(peer->closed);
+  CHECK_EQ(handedBack, 2);
+  CHECK(peer->inbox.find("after") == std::string::npos);
+  CHECK(sendWsMessage(connection, "late", 4, OPCODE_TEXT) == WS_ERR_CLOSED);
+#if WS_METRICS
+  //what was refused isn't counted against the slot's next connection
+  getWsConnectionMetrics(connection, &metrics);
+  CHECK_EQ(metrics.framesOut[OPCODE_TEXT], 0);
+  CHECK_EQ(metrics.bytesOut[OPCODE_TEXT], 0);
+#endif
+  CHECK_EQ(simHeapInUse(), heap);
+  return checkResult("test_txfail");
+}
@@ -0,0 +1,70 @@
+// unmaskWsPayload against a byte-at-a-time reference: every buffer
+// alignment, every starting key offset and lengths either side of the word
+// size, plus a payload unmasked in arbitrary pieces
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "easyWebSocket.cpp"
+#include "check.h"
+
+#define SLACK 16
+
+//***********************************************************************
+// The loop unmaskWsPayload replaced, kept as the reference.
+static uint8_t unmaskBytewise(uint8_t *data, uint32_t length, uint32_t maskingKey, uint8_t keyOffset) {
+  const uint8_t *key = (const uint8_t *)&maskingKey;
+  for (uint32_t i = 0; i < length; i++) {
+    data[i] ^= key[(keyOffset + i) % 4];
+  }
+  return (keyOffset + length) % 4;
+}
+
+int main() {
+  uint8_t buffer[300 + 2 * SLACK], expected[sizeof(buffer)];
+  const uint32_t keys[] = { 0x12345678, 0xffffffff, 0x000000a5, 0 };
+
+  srand(1);
+  for (unsigned k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+    for (uint32_t alignment = 0; alignment < SLACK; alignment++) {
+      for (uint8_t keyOffset = 0; keyOffset < 4; keyOffset++) {
+        for (uint32_t length = 0; length <= 300; length++) {
+          for (uint32_t i = 0; i < sizeof(buffer); i++) {
+            buffer[i] = expected[i] = rand();
+          }
+          uint8_t offset = unmaskWsPayload((char *)buffer + alignment, length, keys[k], keyOffset);
+          uint8_t expectedOffset = unmaskBytewise(expected + alignment, length, keys[k], keyOffset);
+          //bytes outside the payload must be left alone as well
+          if (memcmp(buffer, expected, sizeof(buffer)) != 0 || offset != expectedOffset) {
+            CHECK(!"unmaskWsPayload differs from the bytewise loop");
+            fprintf(stderr, "  key %08x alignment %u keyOffset %u length %u\n",
+                    (unsigned)keys[k], (unsigned)alignment, keyOffset, (unsigned)length);
+            return checkResult("test_unmask");
+          }
+        }
+      }
+    }
+  }
+
+  //a payload arriving in pieces, each unmasked from where the last left off
+  for (int round = 0; round < 2000; round++) {
+    uint32_t length = rand() % 2000, key = rand() * 2654435761u;
+    uint8_t *data = (uint8_t *)malloc(length + 1), *reference = (uint8_t *)malloc(length + 1);
+    for (uint32_t i = 0; i < length; i++) {
+      data[i] = reference[i] = rand();
+    }
+    uint8_t keyOffset = 0;
+    for (uint32_t done = 0; done < length; ) {
+      uint32_t piece = 1 + rand() % (length - done);
+      keyOffset = unmaskWsPayload((char *)data + done, piece, key, keyOffset);
+      done += piece;
+    }
+    unmaskBytewise(reference, length, key, 0);
+    CHECK(memcmp(data, reference, length) == 0);
+    CHECK_EQ(keyOffset, length % 4);
+    free(data);
+    free(reference);
+  }
+
+  return checkResult("test_unmask");
+}
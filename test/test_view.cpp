@@ -0,0 +1,120 @@
+// the view callback: what it is lent, and retainWsView
+
+#include "easyWebSocket.h"
+#include "sim.h"
+#include "peer.h"
+#include "check.h"
+
+#define PORT 9003
+
+static WebSocketServer<2, 2048, 4> server(PORT);
+static int dataTag, viewTag;
+static void *dataContextSeen, *viewContextSeen;
+static std::string viewed;
+static uint8_t viewedOpcode;
+static bool viewedInRxBuffer;
+static bool retainNext;
+static WSRetained *retained;
+
+static void onData(WSConnection *connection, uint8_t opcode, const char *payload, uint32_t length, void *userContext) {
+  dataContextSeen = userContext;
+}
+
+static void onView(const WSView *view, void *userContext) {
+  viewContextSeen = userContext;
+  viewed.assign(view->data, view->length);
+  viewedOpcode = view->opcode;
+  viewedInRxBuffer = view->data >= view->connection->rxBuffer &&
+                     view->data < view->connection->rxBuffer + view->connection->server->rxBufferSize + 1;
+  if (retainNext) {
+    retained = retainWsView(view);
+  }
+}
+
+//***********************************************************************
+static uint32_t poolBlocksInUse( void ) {
+  uint32_t inUse = 0;
+  WSPoolStats stats;
+  for (uint8_t pool = 0; getWsPoolStats(pool, &stats); pool++) {
+    inUse += stats.inUse;
+  }
+  return inUse;
+}
+
+int main() {
+  //each callback gets the context it was set with, whichever is set last
+  server.setViewCallback(onView, &viewTag);
+  server.setDataCallback(onData, &dataTag);
+  server.begin();
+
+  SimPeer *peer = peerOpen(PORT);
+  CHECK(peer != NULL);
+  peerSend(peer, OPCODE_TEXT, "contexts");
+  simRun();
+  CHECK(viewed == "contexts");
+  CHECK(viewContextSeen == &viewTag);
+  CHECK(dataContextSeen == &dataTag);
+
+  //a frame within one segment is lent where it arrived, with nothing
+  //allocated or copied
+  int64_t heap = simHeapInUse();
+  uint64_t allocs = simHeapAllocs();
+  uint32_t blocks = poolBlocksInUse();
+  std::string binary("a\0b\0c", 5);
+  peerSend(peer, OPCODE_BINARY, binary);
+  simRun();
+  CHECK(viewed == binary);
+  CHECK_EQ(viewedOpcode, OPCODE_BINARY);
+  CHECK(!viewedInRxBuffer);
+  CHECK_EQ(simHeapAllocs(), allocs);
+  CHECK_EQ(poolBlocksInUse(), blocks);
+
+  //one split over segments is lent from the connection's receive buffer
+  std::string split(300, 's');
+  simSetSegment(100);
+  peerSend(peer, OPCODE_TEXT, split);
+  simRun();
+  simSetSegment(SIM_MSS);
+  CHECK(viewed == split);
+  CHECK(viewedInRxBuffer);
+  CHECK_EQ(simHeapAllocs(), allocs);
+
+  //a retained copy outlives the segment, which the simulator overwrites
+  //once the callback returns, and is NUL terminated
+  retainNext = true;
+  peerSend(peer, OPCODE_TEXT, "keep me");
+  simRun();
+  retainNext = false;
+  CHECK(retained != NULL);
+  if (retained != NULL) {
+    CHECK_EQ(retained->opcode, OPCODE_TEXT);
+    CHECK_EQ(retained->length, 7);
+    CHECK(strcmp(retained->data, "keep me") == 0);
+    CHECK_EQ(poolBlocksInUse(), blocks + 1);
+    //more traffic doesn't touch it
+    peerSend(peer, OPCODE_TEXT, "something else");
+    simRun();
+    CHECK(strcmp(retained->data, "keep me") == 0);
+    releaseWsRetained(retained);
+    CHECK_EQ(poolBlocksInUse(), blocks);
+  }
+
+  //bigger than any pool block, it comes from the heap and goes back
+  std::string large(1800, 'x');
+  retainNext = true;
+  peerSend(peer, OPCODE_BINARY, large);
+  simRun();
+  retainNext = false;
+  CHECK(retained != NULL);
+  if (retained != NULL) {
+    CHECK(std::string(retained->data, retained->length) == large);
+    CHECK(simHeapInUse() > heap);
+    releaseWsRetained(retained);
+  }
+  CHECK_EQ(simHeapInUse(), heap);
+  CHECK_EQ(poolBlocksInUse(), blocks);
+
+  simClose(peer);
+  simRun();
+  return checkResult("test_view");
+}
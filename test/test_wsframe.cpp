@@ -0,0 +1,92 @@
+// the frame header codec: every first two header bytes, every length up to
+// past the 16 bit form, the boundaries of the 64 bit form, and the bytes on
+// the wire for each length class
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsframe.h"
+#include "check.h"
+
+static const uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+
+//***********************************************************************
+// Encodes and decodes a header, checking it comes back unchanged and in
+// the shortest form.
+static bool roundTrip(uint8_t flagsOpcode, uint64_t length, bool masked) {
+  uint8_t header[WS_MAX_HEADER_LENGTH + 1];
+  WSFrame frame;
+  uint32_t keyWord;
+
+  memcpy(&keyWord, key, sizeof(keyWord));
+  memset(header, 0xee, sizeof(header));
+  uint8_t encoded = wsframe_encodeHeader(header, flagsOpcode, length, masked ? key : NULL);
+  uint8_t expected = 2 + (length < 126 ? 0 : length <= 0xFFFF ? 2 : 8) + (masked ? 4 : 0);
+  if (encoded != expected || header[WS_MAX_HEADER_LENGTH] != 0xee) {
+    return false;
+  }
+  if (wsframe_headerLength(header) != encoded || wsframe_decodeHeader(header, &frame) != encoded) {
+    return false;
+  }
+  return frame.flags == (flagsOpcode & FLAGS_MASK) && frame.opcode == (flagsOpcode & OPCODE_MASK) &&
+         !!frame.isMasked == masked && frame.payloadLength == length &&
+         frame.maskingKey == (masked ? keyWord : 0) &&
+         frame.payloadData == (char *)header + encoded;
+}
+
+int main() {
+  uint8_t header[WS_MAX_HEADER_LENGTH];
+  WSFrame frame;
+
+  //every first two bytes, with the extended length holding 0x0102...
+  for (uint32_t first = 0; first < 0x10000; first++) {
+    const uint8_t bytes[WS_MAX_HEADER_LENGTH] = { (uint8_t)(first >> 8), (uint8_t)first, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+    uint8_t len7 = bytes[1] & PAYLOAD_MASK;
+    bool masked = (bytes[1] & IS_MASKED) != 0;
+    uint8_t length = wsframe_decodeHeader(bytes, &frame);
+    CHECK_EQ(length, wsframe_headerLength(bytes));
+    CHECK_EQ(length, 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + (masked ? 4 : 0));
+    CHECK_EQ(frame.payloadLength, len7 == 126 ? 0x0102 : len7 == 127 ? 0x0102030405060708ULL : len7);
+    CHECK_EQ(frame.flags, bytes[0] & FLAGS_MASK);
+    CHECK_EQ(frame.opcode, bytes[0] & OPCODE_MASK);
+    if (checkFailures) {
+      fprintf(stderr, "  header %02x %02x\n", bytes[0], bytes[1]);
+      return checkResult("test_wsframe");
+    }
+  }
+
+  //every length through the 7 and 16 bit forms and into the 64 bit one
+  for (uint64_t length = 0; length <= 0x10100; length++) {
+    if (!roundTrip(FLAG_FIN | OPCODE_BINARY, length, false) || !roundTrip(OPCODE_TEXT, length, true)) {
+      CHECK(!"round trip failed");
+      fprintf(stderr, "  length %llu\n", (unsigned long long)length);
+      return checkResult("test_wsframe");
+    }
+  }
+
+  //the largest lengths, and random ones of every size
+  const uint64_t large[] = { 0xFFFFFFFFULL, 0x100000000ULL, 0x123456789ABCULL, 0x7FFFFFFFFFFFFFFFULL };
+  for (unsigned i = 0; i < sizeof(large) / sizeof(large[0]); i++) {
+    CHECK(roundTrip(FLAG_FIN | OPCODE_BINARY, large[i], false));
+    CHECK(roundTrip(FLAG_FIN | FLAG_RSV1 | OPCODE_TEXT, large[i], true));
+  }
+  srand(1);
+  for (int i = 0; i < 1000000; i++) {
+    uint64_t length = (((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand()) >> (rand() % 64);
+    CHECK(roundTrip(rand() & 0xff, length, rand() & 1));
+  }
+
+  //the bytes on the wire are big endian, RFC 6455 section 5.2
+  CHECK_EQ(wsframe_encodeHeader(header, FLAG_FIN | OPCODE_TEXT, 125, NULL), 2);
+  CHECK(memcmp(header, "\x81\x7d", 2) == 0);
+  CHECK_EQ(wsframe_encodeHeader(header, FLAG_FIN | OPCODE_TEXT, 126, NULL), 4);
+  CHECK(memcmp(header, "\x81\x7e\x00\x7e", 4) == 0);
+  CHECK_EQ(wsframe_encodeHeader(header, FLAG_FIN | OPCODE_BINARY, 0x1234, key), 8);
+  CHECK(memcmp(header, "\x82\xfe\x12\x34\x37\xfa\x21\x3d", 8) == 0);
+  CHECK_EQ(wsframe_encodeHeader(header, OPCODE_BINARY, 0x10000, NULL), 10);
+  CHECK(memcmp(header, "\x02\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10) == 0);
+  CHECK_EQ(wsframe_encodeHeader(header, OPCODE_BINARY, 0x0102030405060708ULL, key), 14);
+  CHECK(memcmp(header, "\x02\xff\x01\x02\x03\x04\x05\x06\x07\x08\x37\xfa\x21\x3d", 14) == 0);
+
+  return checkResult("test_wsframe");
+}